@@ -0,0 +1,117 @@
+#include "lib_sync.h"
+#include "lib_syscall.h"
+#include "comm/cpu_instr.h"
+
+#define UMUTEX_UNLOCKED 0
+#define UMUTEX_LOCKED 1
+#define UMUTEX_CONTENDED 2
+
+void umutex_init(umutex_t *mutex)
+{
+    mutex->state = UMUTEX_UNLOCKED;
+}
+
+void umutex_lock(umutex_t *mutex)
+{
+    uint32_t c = cmpxchg(&mutex->state, UMUTEX_UNLOCKED, UMUTEX_LOCKED);
+    if (c == UMUTEX_UNLOCKED)
+        return;
+
+    // 有竞争：标记为有等待者后进入内核等待，被唤醒后仍按有等待者加锁，解锁时不会漏掉其他等待者
+    if (c != UMUTEX_CONTENDED)
+        c = xchg(&mutex->state, UMUTEX_CONTENDED);
+
+    while (c != UMUTEX_UNLOCKED)
+    {
+        futex_wait(&mutex->state, UMUTEX_CONTENDED, 0);
+        c = xchg(&mutex->state, UMUTEX_CONTENDED);
+    }
+}
+
+int umutex_trylock(umutex_t *mutex)
+{
+    return (cmpxchg(&mutex->state, UMUTEX_UNLOCKED, UMUTEX_LOCKED) == UMUTEX_UNLOCKED) ? 0 : -1;
+}
+
+void umutex_unlock(umutex_t *mutex)
+{
+    // 原来为1说明没有等待者，直接返回
+    if (xadd(&mutex->state, -1) != UMUTEX_LOCKED)
+    {
+        mutex->state = UMUTEX_UNLOCKED;
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+void ucond_init(ucond_t *cond)
+{
+    cond->seq = 0;
+    cond->waiters = 0;
+}
+
+/**
+ * 解锁前记下seq，解锁后到等待前有通知时seq已改变，futex_wait直接返回
+ */
+void ucond_wait(ucond_t *cond, umutex_t *mutex)
+{
+    uint32_t seq = cond->seq;
+    xadd(&cond->waiters, 1);
+
+    umutex_unlock(mutex);
+    futex_wait(&cond->seq, seq, 0);
+    xadd(&cond->waiters, -1);
+    umutex_lock(mutex);
+}
+
+void ucond_signal(ucond_t *cond)
+{
+    xadd(&cond->seq, 1);
+    if (cond->waiters)
+        futex_wake(&cond->seq, 1);
+}
+
+void ucond_broadcast(ucond_t *cond)
+{
+    xadd(&cond->seq, 1);
+    if (cond->waiters)
+        futex_wake(&cond->seq, cond->waiters);
+}
+
+void usem_init(usem_t *sem, int count)
+{
+    sem->count = count;
+    sem->waiters = 0;
+}
+
+int usem_trywait(usem_t *sem)
+{
+    uint32_t c = sem->count;
+    while (c > 0)
+    {
+        uint32_t old = cmpxchg(&sem->count, c, c - 1);
+        if (old == c)
+            return 0;
+
+        c = old;
+    }
+
+    return -1;
+}
+
+void usem_wait(usem_t *sem)
+{
+    // 计数为0时等待，释放者先加计数再检查waiters，两者之间的释放会使futex_wait直接返回
+    while (usem_trywait(sem) < 0)
+    {
+        xadd(&sem->waiters, 1);
+        futex_wait(&sem->count, 0, 0);
+        xadd(&sem->waiters, -1);
+    }
+}
+
+void usem_post(usem_t *sem)
+{
+    xadd(&sem->count, 1);
+    if (sem->waiters)
+        futex_wake(&sem->count, 1);
+}
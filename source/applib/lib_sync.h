@@ -0,0 +1,48 @@
+#ifndef LIB_SYNC_H
+#define LIB_SYNC_H
+
+#include "comm/types.h"
+
+/**
+ * 用户态互斥锁，state: 0-未锁定 1-已锁定 2-已锁定且可能有等待者
+ * 没有竞争时加锁、解锁都不进入内核；放在共享内存中可用于多个进程之间
+ */
+typedef struct _umutex_t
+{
+    volatile uint32_t state;
+} umutex_t;
+
+/**
+ * 条件变量，seq在每次通知时加1，等待者在seq上等待
+ */
+typedef struct _ucond_t
+{
+    volatile uint32_t seq;
+    volatile uint32_t waiters;
+} ucond_t;
+
+/**
+ * 计数信号量，waiters不为0时释放才进入内核唤醒
+ */
+typedef struct _usem_t
+{
+    volatile uint32_t count;
+    volatile uint32_t waiters;
+} usem_t;
+
+void umutex_init(umutex_t *mutex);
+void umutex_lock(umutex_t *mutex);
+int umutex_trylock(umutex_t *mutex);
+void umutex_unlock(umutex_t *mutex);
+
+void ucond_init(ucond_t *cond);
+void ucond_wait(ucond_t *cond, umutex_t *mutex);
+void ucond_signal(ucond_t *cond);
+void ucond_broadcast(ucond_t *cond);
+
+void usem_init(usem_t *sem, int count);
+void usem_wait(usem_t *sem);
+int usem_trywait(usem_t *sem);
+void usem_post(usem_t *sem);
+
+#endif
@@ -1,7 +1,14 @@
 #include "lib_syscall.h"
+#include "comm/cpu_instr.h"
+#include "comm/vdata.h"
 #include <stdlib.h>
 
-int sys_call(syscall_args_t *args)
+static int sysenter_support = -1; // 首次系统调用时检测
+
+/**
+ * 经调用门进入内核，参数压在用户栈上，由CPU复制到内核栈
+ */
+int sys_call_gate(syscall_args_t *args)
 {
     uint32_t addr[] = {0, SELECTOR_SYSCALL | 0};
     int ret;
@@ -25,6 +32,26 @@ int sys_call(syscall_args_t *args)
     return ret;
 }
 
+/**
+ * 检查CPU是否支持sysenter，内核按同样的条件设置其入口
+ */
+int sys_call_has_sysenter(void)
+{
+    if (sysenter_support < 0)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        sysenter_support = (edx & CPUID_EDX_SEP) != 0;
+    }
+
+    return sysenter_support;
+}
+
+int sys_call(syscall_args_t *args)
+{
+    return sys_call_has_sysenter() ? sys_call_sysenter(args) : sys_call_gate(args);
+}
+
 int msleep(int ms)
 {
     if (ms <= 0)
@@ -36,11 +63,23 @@ int msleep(int ms)
     return sys_call(&args);
 }
 
+/**
+ * 从内核映射的只读数据页中读取，不进入内核
+ */
 int getpid(void)
 {
-    syscall_args_t args;
-    args.id = SYS_getpid;
-    return sys_call(&args);
+    return ((vdata_proc_t *)VDATA_PROC_ADDR)->pid;
+}
+
+int clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+    if (clk_id != CLOCK_MONOTONIC)
+        return -1;
+
+    uint32_t ms = ((vdata_t *)VDATA_ADDR)->ms;
+    tp->tv_sec = ms / 1000;
+    tp->tv_nsec = (ms % 1000) * 1000000;
+    return 0;
 }
 
 void print_msg(const char *fmt, int arg)
@@ -72,6 +111,18 @@ int execve(const char *name, char *const *argv, char *const *env)
     return sys_call(&args);
 }
 
+int spawn(const char *name, char *const *argv, char *const *env, const spawn_action_t *actions)
+{
+    syscall_args_t args;
+    args.id = SYS_spawn;
+    args.arg0 = (int)name;
+    args.arg1 = (int)argv;
+    args.arg2 = (int)env;
+    args.arg3 = (int)actions;
+
+    return sys_call(&args);
+}
+
 int yield(void)
 {
     syscall_args_t args;
@@ -169,6 +220,137 @@ int dup(int file)
     return sys_call(&args);
 }
 
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    mmap_args_t mmap_args;
+    mmap_args.addr = addr;
+    mmap_args.length = length;
+    mmap_args.prot = prot;
+    mmap_args.flags = flags;
+    mmap_args.fd = fd;
+    mmap_args.offset = offset;
+
+    syscall_args_t args;
+    args.id = SYS_mmap;
+    args.arg0 = (int)&mmap_args;
+
+    return (void *)sys_call(&args);
+}
+
+int munmap(void *addr, size_t length)
+{
+    syscall_args_t args;
+    args.id = SYS_munmap;
+    args.arg0 = (int)addr;
+    args.arg1 = (int)length;
+
+    return sys_call(&args);
+}
+
+int madvise(void *addr, size_t length, int advice)
+{
+    syscall_args_t args;
+    args.id = SYS_madvise;
+    args.arg0 = (int)addr;
+    args.arg1 = (int)length;
+    args.arg2 = advice;
+
+    return sys_call(&args);
+}
+
+int meminfo(mem_stat_t *stat)
+{
+    syscall_args_t args;
+    args.id = SYS_meminfo;
+    args.arg0 = (int)stat;
+
+    return sys_call(&args);
+}
+
+int taskinfo(task_stat_t *stat, int count)
+{
+    syscall_args_t args;
+    args.id = SYS_taskinfo;
+    args.arg0 = (int)stat;
+    args.arg1 = count;
+
+    return sys_call(&args);
+}
+
+/**
+ * @brief 设置进程的nice值，pid为0表示当前进程，值越小优先级越高
+ */
+int setpriority(int pid, int nice)
+{
+    syscall_args_t args;
+    args.id = SYS_setpriority;
+    args.arg0 = pid;
+    args.arg1 = nice;
+
+    return sys_call(&args);
+}
+
+int getpriority(int pid)
+{
+    syscall_args_t args;
+    args.id = SYS_getpriority;
+    args.arg0 = pid;
+
+    return sys_call(&args);
+}
+
+/**
+ * @brief 调整当前进程的nice值，返回调整后的值
+ */
+int nice(int incr)
+{
+    if (setpriority(0, getpriority(0) + incr) < 0)
+        return -1;
+
+    return getpriority(0);
+}
+
+int shmget(int key, size_t size, int flags)
+{
+    syscall_args_t args;
+    args.id = SYS_shmget;
+    args.arg0 = key;
+    args.arg1 = (int)size;
+    args.arg2 = flags;
+
+    return sys_call(&args);
+}
+
+void *shmat(int id, const void *addr, int flags)
+{
+    syscall_args_t args;
+    args.id = SYS_shmat;
+    args.arg0 = id;
+    args.arg1 = (int)addr;
+    args.arg2 = flags;
+
+    return (void *)sys_call(&args);
+}
+
+int shmdt(const void *addr)
+{
+    syscall_args_t args;
+    args.id = SYS_shmdt;
+    args.arg0 = (int)addr;
+
+    return sys_call(&args);
+}
+
+int shmctl(int id, int cmd)
+{
+    syscall_args_t args;
+    args.id = SYS_shmctl;
+    args.arg0 = id;
+    args.arg1 = cmd;
+
+    return sys_call(&args);
+}
+
 int ioctl(int file, int cmd, int arg0, int arg1)
 {
     syscall_args_t args;
@@ -251,4 +433,128 @@ int unlink(const char *pathname)
     args.id = SYS_unlink;
     args.arg0 = (int)pathname;
     return sys_call(&args);
-}
\ No newline at end of file
+}
+
+/**
+ * addr处的值仍为expected时等待，ms为0时一直等待
+ */
+int futex_wait(volatile uint32_t *addr, uint32_t expected, int ms)
+{
+    syscall_args_t args;
+    args.id = SYS_futex_wait;
+    args.arg0 = (int)addr;
+    args.arg1 = (int)expected;
+    args.arg2 = ms;
+    return sys_call(&args);
+}
+
+int futex_wake(volatile uint32_t *addr, int count)
+{
+    syscall_args_t args;
+    args.id = SYS_futex_wake;
+    args.arg0 = (int)addr;
+    args.arg1 = count;
+    return sys_call(&args);
+}
+
+/**
+ * 初始化异步提交队列并注册到内核，entries须为2的幂
+ */
+int ring_init(ring_t *ring, int entries)
+{
+    if ((entries <= 0) || (entries > RING_ENTRIES_MAX) || (entries & (entries - 1)))
+        return -1;
+
+    ring->entries = entries;
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    ring->sqes = (ring_sqe_t *)malloc(entries * sizeof(ring_sqe_t));
+    ring->cqes = (ring_cqe_t *)malloc(entries * sizeof(ring_cqe_t));
+    if (!ring->sqes || !ring->cqes)
+    {
+        free(ring->sqes);
+        free(ring->cqes);
+        return -1;
+    }
+
+    syscall_args_t args;
+    args.id = SYS_ring_setup;
+    args.arg0 = (int)ring;
+    if (sys_call(&args) < 0)
+    {
+        free(ring->sqes);
+        free(ring->cqes);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * 注销队列，等已提交的操作中正在执行的一项完成，未开始的不再执行
+ */
+void ring_free(ring_t *ring)
+{
+    syscall_args_t args;
+    args.id = SYS_ring_release;
+    sys_call(&args);
+
+    free(ring->sqes);
+    free(ring->cqes);
+    ring->sqes = (ring_sqe_t *)0;
+    ring->cqes = (ring_cqe_t *)0;
+}
+
+/**
+ * 取提交队列中的下一个空项，填写后由ring_submit统一提交；队列满时返回0
+ */
+ring_sqe_t *ring_get_sqe(ring_t *ring)
+{
+    if (ring->sq_tail - ring->sq_head >= ring->entries)
+        return (ring_sqe_t *)0;
+
+    ring_sqe_t *sqe = ring->sqes + (ring->sq_tail++ & (ring->entries - 1));
+    sqe->opcode = RING_OP_NOP;
+    sqe->fd = -1;
+    sqe->addr = (void *)0;
+    sqe->len = sqe->flags = 0;
+    sqe->user_data = 0;
+    return sqe;
+}
+
+/**
+ * 提交所有已填写的项后立即返回，由内核线程执行，返回提交的项数
+ */
+int ring_submit(ring_t *ring)
+{
+    return ring_submit_and_wait(ring, 0);
+}
+
+/**
+ * 提交后等到完成队列中至少有min_complete项，或已提交的项全部执行完
+ */
+int ring_submit_and_wait(ring_t *ring, int min_complete)
+{
+    syscall_args_t args;
+    args.id = SYS_ring_enter;
+    args.arg0 = (int)ring;
+    args.arg1 = ring->sq_tail - ring->sq_head;
+    args.arg2 = min_complete;
+    return sys_call(&args);
+}
+
+/**
+ * 取最早的完成项，处理后调用ring_cqe_seen；没有时返回0
+ */
+ring_cqe_t *ring_peek_cqe(ring_t *ring)
+{
+    if (ring->cq_head == ring->cq_tail)
+        return (ring_cqe_t *)0;
+
+    return ring->cqes + (ring->cq_head & (ring->entries - 1));
+}
+
+void ring_cqe_seen(ring_t *ring)
+{
+    ring->cq_head++;
+}
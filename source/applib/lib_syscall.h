@@ -5,6 +5,11 @@
 #include "os_cfg.h"
 
 #include <sys/stat.h>
+#include <time.h>
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 4 // 启动后经过的时间，精度为1ms
+#endif
 
 typedef struct _syscall_args_t
 {
@@ -16,10 +21,14 @@ typedef struct _syscall_args_t
 } syscall_args_t;
 
 int sys_call(syscall_args_t *args);
+int sys_call_gate(syscall_args_t *args);
+int sys_call_sysenter(syscall_args_t *args);
+int sys_call_has_sysenter(void);
 
 int msleep(int ms);
 
 int getpid(void);
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
 
 void print_msg(const char *fmt, int arg);
 
@@ -27,6 +36,9 @@ int fork(void);
 
 int execve(const char *name, char *const *argv, char *const *env);
 
+int vfork(void);
+int spawn(const char *name, char *const *argv, char *const *env, const spawn_action_t *actions);
+
 int yield(void);
 
 int open(const char *name, int flags, ...);
@@ -43,6 +55,22 @@ void *sbrk(ptrdiff_t incr);
 
 int dup(int file);
 
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t length);
+int madvise(void *addr, size_t length, int advice);
+
+int meminfo(mem_stat_t *stat);
+int taskinfo(task_stat_t *stat, int count);
+
+int setpriority(int pid, int nice);
+int getpriority(int pid);
+int nice(int incr);
+
+int shmget(int key, size_t size, int flags);
+void *shmat(int id, const void *addr, int flags);
+int shmdt(const void *addr);
+int shmctl(int id, int cmd);
+
 void _exit(int status);
 int wait(int *status);
 
@@ -64,4 +92,15 @@ DIR *opendir(const char *path);
 struct dirent *readdir(DIR *dir);
 int closedir(DIR *dir);
 
+int futex_wait(volatile uint32_t *addr, uint32_t expected, int ms);
+int futex_wake(volatile uint32_t *addr, int count);
+
+int ring_init(ring_t *ring, int entries);
+void ring_free(ring_t *ring);
+ring_sqe_t *ring_get_sqe(ring_t *ring);
+int ring_submit(ring_t *ring);
+int ring_submit_and_wait(ring_t *ring, int min_complete);
+ring_cqe_t *ring_peek_cqe(ring_t *ring);
+void ring_cqe_seen(ring_t *ring);
+
 #endif
\ No newline at end of file
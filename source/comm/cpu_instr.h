@@ -112,6 +112,11 @@ static inline void write_cr3(uint32_t v)
     __asm__ __volatile__("mov %[v], %%cr3" ::[v] "r"(v));
 }
 
+static inline void invlpg(uint32_t vaddr)
+{
+    __asm__ __volatile__("invlpg (%[v])" ::[v] "r"(vaddr) : "memory");
+}
+
 static inline uint32_t read_cr4(void)
 {
     uint32_t cr4;
@@ -137,11 +142,89 @@ static inline void hlt(void)
     __asm__ __volatile__("hlt");
 }
 
+// sti的下一条指令执行完才响应中断，开中断与停机之间不会丢失中断
+static inline void sti_hlt(void)
+{
+    __asm__ __volatile__("sti\n\thlt");
+}
+
+static inline uint32_t read_tsc(void)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc"
+                         : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
 static inline void write_tr(uint16_t tss_sel)
 {
     __asm__ __volatile__("ltr %%ax" ::"a"(tss_sel));
 }
 
+static inline uint16_t read_tr(void)
+{
+    uint16_t tss_sel;
+
+    __asm__ __volatile__("str %0"
+                         : "=r"(tss_sel));
+    return tss_sel;
+}
+
+static inline void sgdt(void *gdtr)
+{
+    __asm__ __volatile__("sgdt (%0)" ::"r"(gdtr)
+                         : "memory");
+}
+
+static inline uint32_t xchg(volatile uint32_t *addr, uint32_t value)
+{
+    __asm__ __volatile__("xchg %0, %1"
+                         : "+m"(*addr), "+r"(value)
+                         :
+                         : "memory");
+    return value;
+}
+
+// 返回原值，与old相等时已写入value
+static inline uint32_t cmpxchg(volatile uint32_t *addr, uint32_t old, uint32_t value)
+{
+    __asm__ __volatile__("lock cmpxchg %2, %1"
+                         : "+a"(old), "+m"(*addr)
+                         : "r"(value)
+                         : "memory");
+    return old;
+}
+
+// 原子地加上value，返回原值
+static inline uint32_t xadd(volatile uint32_t *addr, uint32_t value)
+{
+    __asm__ __volatile__("lock xadd %1, %0"
+                         : "+m"(*addr), "+r"(value)
+                         :
+                         : "memory");
+    return value;
+}
+
+static inline void pause(void)
+{
+    __asm__ __volatile__("pause");
+}
+
+#define CPUID_EDX_SEP (1 << 11) // 支持sysenter/sysexit
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                         : "a"(leaf));
+}
+
+static inline void write_msr(uint32_t msr, uint32_t value)
+{
+    __asm__ __volatile__("wrmsr" ::"c"(msr), "a"(value), "d"(0));
+}
+
 static inline uint32_t read_eflags(void)
 {
     uint32_t eflags;
@@ -42,6 +42,10 @@ typedef struct
 
 #define PT_LOAD 1
 
+#define PF_X 1
+#define PF_W 2
+#define PF_R 4
+
 typedef struct
 {
     Elf32_Word p_type;
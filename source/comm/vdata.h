@@ -0,0 +1,28 @@
+#ifndef VDATA_H
+#define VDATA_H
+
+#include "types.h"
+
+#define VDATA_ADDR 0xE0000000                 // 位于用户栈顶之上，所有进程相同
+#define VDATA_PROC_ADDR (VDATA_ADDR + 4096)   // 紧随其后的是进程自己的数据页
+#define VDATA_END (VDATA_PROC_ADDR + 4096)
+
+/**
+ * 系统数据页，所有进程映射同一物理页，用户只读
+ * 各字段均为单独的32位字，由内核在时钟中断中更新，用户可直接读取
+ */
+typedef struct _vdata_t
+{
+    volatile uint32_t ticks;
+    volatile uint32_t ms; // 启动后经过的毫秒数
+} vdata_t;
+
+/**
+ * 进程数据页，每个地址空间一页，用户只读
+ */
+typedef struct _vdata_proc_t
+{
+    volatile int pid; // 当前使用该地址空间的进程，vfork的子进程运行时为子进程
+} vdata_proc_t;
+
+#endif
@@ -0,0 +1,190 @@
+#include "core/image.h"
+#include "core/kmem.h"
+#include "core/memory.h"
+#include "ipc/mutex.h"
+#include "tools/log.h"
+#include "tools/klib.h"
+
+static list_t image_list; // 最近使用的在前
+static mutex_t image_mutex;
+static kmem_cache_t image_cache;
+
+static void image_free(image_t *image)
+{
+    for (int i = 0; i < image->page_count; i++)
+    {
+        if (image->pages[i].vaddr)
+            memory_put_page(image->pages[i].paddr);
+    }
+
+    kfree(image->pages);
+    kmem_cache_free(&image_cache, image);
+}
+
+/**
+ * 文件中offset所在的页，超出文件大小时返回0
+ */
+static image_page_t *image_page(image_t *image, uint32_t offset)
+{
+    uint32_t index = offset / MEM_PAGE_SIZE;
+    return (index < image->page_count) ? image->pages + index : (image_page_t *)0;
+}
+
+static void image_unref(image_t *image)
+{
+    if (--image->ref == 0)
+        image_free(image);
+}
+
+void image_init(void)
+{
+    list_init(&image_list);
+    mutex_init(&image_mutex);
+    kmem_cache_init(&image_cache, "image", sizeof(image_t), 0);
+}
+
+/**
+ * @brief 获取文件对应的映像，不在缓存中时新建，缓存满时淘汰最久未使用的
+ */
+image_t *image_get(file_t *file)
+{
+    mutex_lock(&image_mutex);
+
+    list_node_t *node = list_first(&image_list);
+    while (node)
+    {
+        image_t *image = list_node_parent(node, image_t, node);
+        if ((image->fs == file->fs) && (image->sblk == file->sblk) && (image->size == file->size))
+        {
+            list_remove(&image_list, node);
+            list_insert_first(&image_list, node);
+            image->ref++;
+
+            mutex_unlock(&image_mutex);
+            return image;
+        }
+
+        node = list_node_next(node);
+    }
+
+    image_t *image = (image_t *)kmem_cache_alloc(&image_cache);
+    if (image == (image_t *)0)
+    {
+        log_printf("image: no memory for %s", file->file_name);
+        mutex_unlock(&image_mutex);
+        return (image_t *)0;
+    }
+
+    image->page_count = up2(file->size, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
+    image->pages = (image_page_t *)kmalloc(image->page_count * sizeof(image_page_t));
+    if (image->pages == (image_page_t *)0)
+    {
+        log_printf("image: no memory for %s", file->file_name);
+        kmem_cache_free(&image_cache, image);
+        mutex_unlock(&image_mutex);
+        return (image_t *)0;
+    }
+    kernel_memset(image->pages, 0, image->page_count * sizeof(image_page_t));
+
+    image->fs = file->fs;
+    image->sblk = file->sblk;
+    image->size = file->size;
+    image->ref = 2;
+    list_insert_first(&image_list, &image->node);
+
+    // 被淘汰的映像仍被进程使用时，由最后一个进程释放
+    if (list_count(&image_list) > IMAGE_CACHE_NR)
+    {
+        list_node_t *last = list_last(&image_list);
+        list_remove(&image_list, last);
+        image_unref(list_node_parent(last, image_t, node));
+    }
+
+    mutex_unlock(&image_mutex);
+    return image;
+}
+
+void image_inc_ref(image_t *image)
+{
+    mutex_lock(&image_mutex);
+    image->ref++;
+    mutex_unlock(&image_mutex);
+}
+
+void image_put(image_t *image)
+{
+    mutex_lock(&image_mutex);
+    image_unref(image);
+    mutex_unlock(&image_mutex);
+}
+
+/**
+ * @brief 查找文件offset处已装入到vaddr的页，返回物理地址，调用者需持有映像的引用
+ */
+uint32_t image_find_page(image_t *image, uint32_t offset, uint32_t vaddr)
+{
+    uint32_t paddr = 0;
+    mutex_lock(&image_mutex);
+
+    image_page_t *page = image_page(image, offset);
+    if (page && (page->vaddr == vaddr))
+        paddr = page->paddr;
+
+    mutex_unlock(&image_mutex);
+    return paddr;
+}
+
+/**
+ * @brief 将新装入的页加入映像，映像接管调用者对该页的引用
+ * 其它进程已先装入同一页时释放新页，返回已有的页
+ * 失败或该文件页已缓存了其它虚拟页时返回0，页仍归调用者
+ */
+uint32_t image_add_page(image_t *image, uint32_t offset, uint32_t vaddr, uint32_t paddr)
+{
+    mutex_lock(&image_mutex);
+
+    image_page_t *page = image_page(image, offset);
+    if ((page == (image_page_t *)0) || (page->vaddr && (page->vaddr != vaddr)))
+    {
+        mutex_unlock(&image_mutex);
+        return 0;
+    }
+
+    if (page->vaddr)
+    {
+        uint32_t exist = page->paddr;
+        mutex_unlock(&image_mutex);
+
+        memory_put_page(paddr);
+        return exist;
+    }
+
+    page->vaddr = vaddr;
+    page->paddr = paddr;
+
+    mutex_unlock(&image_mutex);
+    return paddr;
+}
+
+/**
+ * @brief 文件被修改后从缓存中移除，之后启动的进程重新从文件装入
+ */
+void image_invalidate(file_t *file)
+{
+    mutex_lock(&image_mutex);
+
+    list_node_t *node = list_first(&image_list);
+    while (node)
+    {
+        image_t *image = list_node_parent(node, image_t, node);
+        node = list_node_next(node);
+
+        if ((image->fs == file->fs) && (image->sblk == file->sblk))
+        {
+            list_remove(&image_list, &image->node);
+            image_unref(image);
+        }
+    }
+
+    mutex_unlock(&image_mutex);
+}
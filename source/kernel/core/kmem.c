@@ -0,0 +1,219 @@
+#include "core/kmem.h"
+#include "core/memory.h"
+#include "cpu/irq.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+
+#define KMEM_SLAB_HDR_SIZE up2(sizeof(kmem_slab_t), 8)
+
+static list_t cache_list;
+static kmem_cache_t kmalloc_caches[KMEM_SIZE_NR];
+static int large_page_count; // kmalloc直接分配的大块占用的页数
+
+static void **obj_link(kmem_cache_t *cache, void *obj)
+{
+    // 有构造函数时对象内容需要保留，链接指针放在对象之后
+    return (void **)((uint8_t *)obj + (cache->ctor ? cache->obj_size : 0));
+}
+
+static int obj_stride(kmem_cache_t *cache)
+{
+    return cache->obj_size + (cache->ctor ? sizeof(void *) : 0);
+}
+
+static kmem_slab_t *slab_create(kmem_cache_t *cache)
+{
+    kmem_slab_t *slab = (kmem_slab_t *)memory_alloc_page();
+    if (slab == (kmem_slab_t *)0)
+    {
+        log_printf("kmem: no memory for cache %s", cache->name);
+        return (kmem_slab_t *)0;
+    }
+
+    list_node_init(&slab->node);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_obj = (void *)0;
+
+    uint8_t *obj = (uint8_t *)slab + KMEM_SLAB_HDR_SIZE + (cache->obj_per_slab - 1) * obj_stride(cache);
+    for (int i = 0; i < cache->obj_per_slab; i++, obj -= obj_stride(cache))
+    {
+        if (cache->ctor)
+            cache->ctor(obj);
+
+        *obj_link(cache, obj) = slab->free_obj;
+        slab->free_obj = obj;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+/**
+ * @brief 初始化对象缓存，对象不能超过一页
+ */
+int kmem_cache_init(kmem_cache_t *cache, const char *name, int obj_size, void (*ctor)(void *obj))
+{
+    kernel_memset(cache, 0, sizeof(kmem_cache_t));
+    kernel_strncpy(cache->name, name, KMEM_NAME_SIZE);
+    cache->obj_size = up2(obj_size < sizeof(void *) ? sizeof(void *) : obj_size, sizeof(void *));
+    cache->ctor = ctor;
+    cache->obj_per_slab = (MEM_PAGE_SIZE - KMEM_SLAB_HDR_SIZE) / obj_stride(cache);
+    if (cache->obj_per_slab <= 0)
+    {
+        log_printf("kmem: object too large, cache %s, size %d", name, obj_size);
+        return -1;
+    }
+
+    list_init(&cache->partial_list);
+    list_init(&cache->full_list);
+    list_init(&cache->free_list);
+
+    irq_state_t state = irq_enter_protection();
+    list_insert_last(&cache_list, &cache->node);
+    irq_leave_protection(state);
+    return 0;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+    irq_state_t state = irq_enter_protection();
+
+    // 优先从部分空闲的slab中分配，减少空闲页的占用
+    kmem_slab_t *slab;
+    if (!list_is_empty(&cache->partial_list))
+        slab = list_node_parent(list_remove_first(&cache->partial_list), kmem_slab_t, node);
+    else if (!list_is_empty(&cache->free_list))
+        slab = list_node_parent(list_remove_first(&cache->free_list), kmem_slab_t, node);
+    else
+        slab = slab_create(cache);
+
+    if (slab == (kmem_slab_t *)0)
+    {
+        irq_leave_protection(state);
+        return (void *)0;
+    }
+
+    void *obj = slab->free_obj;
+    slab->free_obj = *obj_link(cache, obj);
+    slab->inuse++;
+    cache->obj_count++;
+
+    if (slab->inuse == cache->obj_per_slab)
+        list_insert_first(&cache->full_list, &slab->node);
+    else
+        list_insert_first(&cache->partial_list, &slab->node);
+
+    irq_leave_protection(state);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+    kmem_slab_t *slab = (kmem_slab_t *)down2((uint32_t)obj, MEM_PAGE_SIZE);
+    ASSERT(slab->cache == cache);
+
+    irq_state_t state = irq_enter_protection();
+
+    if (slab->inuse == cache->obj_per_slab)
+        list_remove(&cache->full_list, &slab->node);
+    else
+        list_remove(&cache->partial_list, &slab->node);
+
+    *obj_link(cache, obj) = slab->free_obj;
+    slab->free_obj = obj;
+    slab->inuse--;
+    cache->obj_count--;
+
+    if (slab->inuse > 0)
+        list_insert_first(&cache->partial_list, &slab->node);
+    else if (list_is_empty(&cache->free_list))
+        list_insert_first(&cache->free_list, &slab->node);
+    else
+    {
+        // 已有一个空闲slab备用，多余的归还给页分配器
+        cache->slab_count--;
+        memory_free_page((uint32_t)slab);
+    }
+
+    irq_leave_protection(state);
+}
+
+/**
+ * @brief 通用内存分配，小对象按大小级别从缓存分配，大块直接分配连续页
+ */
+void *kmalloc(int size)
+{
+    if (size <= 0)
+        return (void *)0;
+
+    int obj_size = KMEM_MIN_SIZE;
+    for (int i = 0; i < KMEM_SIZE_NR; i++, obj_size <<= 1)
+    {
+        if (size <= obj_size)
+            return kmem_cache_alloc(kmalloc_caches + i);
+    }
+
+    int page_count = up2(size + KMEM_SLAB_HDR_SIZE, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
+    kmem_slab_t *slab = (kmem_slab_t *)memory_alloc_pages(page_count);
+    if (slab == (kmem_slab_t *)0)
+        return (void *)0;
+
+    slab->cache = (kmem_cache_t *)0;
+    slab->inuse = page_count;
+
+    irq_state_t state = irq_enter_protection();
+    large_page_count += page_count;
+    irq_leave_protection(state);
+    return (uint8_t *)slab + KMEM_SLAB_HDR_SIZE;
+}
+
+void kfree(void *ptr)
+{
+    if (ptr == (void *)0)
+        return;
+
+    kmem_slab_t *slab = (kmem_slab_t *)down2((uint32_t)ptr, MEM_PAGE_SIZE);
+    if (slab->cache)
+        kmem_cache_free(slab->cache, ptr);
+    else
+    {
+        irq_state_t state = irq_enter_protection();
+        large_page_count -= slab->inuse;
+        irq_leave_protection(state);
+
+        memory_free_pages((uint32_t)slab, slab->inuse);
+    }
+}
+
+/**
+ * @brief 所有缓存及大块分配占用的页数
+ */
+int kmem_page_count(void)
+{
+    irq_state_t state = irq_enter_protection();
+
+    int count = large_page_count;
+    list_node_t *node = list_first(&cache_list);
+    while (node)
+    {
+        count += list_node_parent(node, kmem_cache_t, node)->slab_count;
+        node = list_node_next(node);
+    }
+
+    irq_leave_protection(state);
+    return count;
+}
+
+void kmem_init(void)
+{
+    list_init(&cache_list);
+
+    int obj_size = KMEM_MIN_SIZE;
+    for (int i = 0; i < KMEM_SIZE_NR; i++, obj_size <<= 1)
+    {
+        char name[KMEM_NAME_SIZE];
+        kernel_sprintf(name, "kmalloc-%d", obj_size);
+        kmem_cache_init(kmalloc_caches + i, name, obj_size, 0);
+    }
+}
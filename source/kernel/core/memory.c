@@ -3,43 +3,434 @@
 #include "tools/klib.h"
 #include "cpu/mmu.h"
 #include "dev/console.h"
+#include "cpu/irq.h"
+#include "fs/fs.h"
+#include "fs/ring.h"
+#include "core/kmem.h"
+#include "core/image.h"
+#include "ipc/sem.h"
+#include "comm/vdata.h"
+#include <sys/fcntl.h>
 
 static addr_alloc_t paddr_alloc;
+static addr_alloc_t highmem_alloc; // 高端内存，没有固定的内核映射
 
 static pde_t kernel_page_dir[PDE_CNT] __attribute__((aligned(MEM_PAGE_SIZE)));
+static pte_t kmap_table[PTE_CNT] __attribute__((aligned(MEM_PAGE_SIZE))); // 临时映射窗口的页表
+static sem_t kmap_sem;
+static mem_stat_t mem_stat; // 只记录累计值及页表数，其余在查询时统计
+static kmem_cache_t region_cache;
+static list_t zero_list;         // 预清零的页，通过页描述结构链接
+static mem_zero_info_t zero_info;
+static int zero_refilling;
+static uint32_t vdata_page; // 系统数据页，位于低端内存，内核可直接写入
+
+static void buddy_insert(addr_alloc_t *alloc, int index, int order)
+{
+    mem_page_t *page = alloc->pages + index;
+    page->flags |= MEM_PAGE_FREE;
+    page->order = order;
+    list_insert_first(&alloc->free_list[order], &page->node);
+    alloc->free_count += 1 << order;
+}
+
+static void buddy_remove(addr_alloc_t *alloc, int index, int order)
+{
+    mem_page_t *page = alloc->pages + index;
+    page->flags &= ~MEM_PAGE_FREE;
+    list_remove(&alloc->free_list[order], &page->node);
+    alloc->free_count -= 1 << order;
+}
+
+/**
+ * 归还一个块，并不断与空闲的伙伴块合并成更大的块
+ */
+static void buddy_free_block(addr_alloc_t *alloc, int index, int order)
+{
+    int page_count = alloc->size / alloc->page_size;
+
+    while (order < MEM_BUDDY_ORDER_NR - 1)
+    {
+        int buddy = index ^ (1 << order);
+        if (buddy + (1 << order) > page_count)
+            break;
+
+        mem_page_t *page = alloc->pages + buddy;
+        if (!(page->flags & MEM_PAGE_FREE) || (page->order != order))
+            break;
+
+        buddy_remove(alloc, buddy, order);
+        index &= ~(1 << order);
+        order++;
+    }
+
+    buddy_insert(alloc, index, order);
+}
+
+/**
+ * 从不小于order的最小空闲块中分配，多余部分逐级拆分后放回
+ */
+static int buddy_alloc_block(addr_alloc_t *alloc, int order)
+{
+    int curr = order;
+    while ((curr < MEM_BUDDY_ORDER_NR) && list_is_empty(&alloc->free_list[curr]))
+        curr++;
 
-static void addr_alloc_init(addr_alloc_t *alloc, uint8_t *bits, uint32_t start,
+    if (curr >= MEM_BUDDY_ORDER_NR)
+        return -1;
+
+    mem_page_t *page = list_node_parent(list_first(&alloc->free_list[curr]), mem_page_t, node);
+    int index = page - alloc->pages;
+    buddy_remove(alloc, index, curr);
+
+    while (curr > order)
+    {
+        curr--;
+        buddy_insert(alloc, index + (1 << curr), curr);
+    }
+
+    return index;
+}
+
+/**
+ * 初始化分配器，页描述表放在pages处
+ * 描述表位于所管理区域的开头时，其占用的页不参与分配
+ */
+static void addr_alloc_init(addr_alloc_t *alloc, mem_page_t *pages, uint32_t start,
                             uint32_t size, uint32_t page_size)
 {
-    mutex_init(&alloc->mutex);
     alloc->start = start;
     alloc->size = size;
     alloc->page_size = page_size;
-    bitmap_init(&alloc->bitmap, bits, alloc->size / page_size, 0);
+    alloc->free_count = 0;
+    spin_init(&alloc->lock);
+    for (int i = 0; i < MEM_BUDDY_ORDER_NR; i++)
+        list_init(&alloc->free_list[i]);
+
+    int page_count = size / page_size;
+    alloc->pages = pages;
+    kernel_memset(alloc->pages, 0, page_count * sizeof(mem_page_t));
+
+    int desc_pages = 0;
+    if ((uint32_t)pages == start)
+    {
+        desc_pages = up2(page_count * sizeof(mem_page_t), page_size) / page_size;
+        for (int i = 0; i < desc_pages; i++)
+            alloc->pages[i].ref = 1;
+    }
+
+    // 其余的页按尽可能大的对齐块加入空闲链表
+    int index = desc_pages;
+    while (index < page_count)
+    {
+        int order = 0;
+        while ((order + 1 < MEM_BUDDY_ORDER_NR) &&
+               ((index & ((1 << (order + 1)) - 1)) == 0) &&
+               (index + (1 << (order + 1)) <= page_count))
+        {
+            order++;
+        }
+
+        buddy_insert(alloc, index, order);
+        index += 1 << order;
+    }
 }
 
 static uint32_t addr_alloc_page(addr_alloc_t *alloc, int page_count)
 {
-    uint32_t addr = 0;
-    mutex_lock(&alloc->mutex);
+    int order = 0;
+    while ((1 << order) < page_count)
+        order++;
+
+    if (order >= MEM_BUDDY_ORDER_NR)
+        return 0;
 
-    int page_index = bitmap_alloc_nbits(&alloc->bitmap, 0, page_count);
-    if (page_index >= 0)
-        addr = alloc->start + page_index * alloc->page_size;
+    irq_state_t state = spin_lock_irqsave(&alloc->lock);
 
-    mutex_unlock(&alloc->mutex);
-    return addr;
+    int index = buddy_alloc_block(alloc, order);
+    if (index < 0)
+    {
+        spin_unlock_irqrestore(&alloc->lock, state);
+        return 0;
+    }
+
+    // 块比所需的大时，将尾部按对齐的小块归还
+    int tail = index + page_count;
+    int end = index + (1 << order);
+    while (tail < end)
+    {
+        int tail_order = 0;
+        while (((tail & ((1 << (tail_order + 1)) - 1)) == 0) &&
+               (tail + (1 << (tail_order + 1)) <= end))
+        {
+            tail_order++;
+        }
+
+        buddy_free_block(alloc, tail, tail_order);
+        tail += 1 << tail_order;
+    }
+
+    for (int i = 0; i < page_count; i++)
+        alloc->pages[index + i].ref = 1;
+
+    spin_unlock_irqrestore(&alloc->lock, state);
+    return alloc->start + index * alloc->page_size;
 }
 
 static void addr_free_page(addr_alloc_t *alloc, uint32_t addr,
                            int page_count)
 {
-    mutex_lock(&alloc->mutex);
+    irq_state_t state = spin_lock_irqsave(&alloc->lock);
+
+    int index = (addr - alloc->start) / alloc->page_size;
+    for (int i = 0; i < page_count; i++, index++)
+    {
+        // 页可能被多个进程共享，只有最后一个使用者释放时才真正回收
+        mem_page_t *page = alloc->pages + index;
+        ASSERT(page->ref > 0);
+        if (--page->ref == 0)
+            buddy_free_block(alloc, index, 0);
+    }
+
+    spin_unlock_irqrestore(&alloc->lock, state);
+}
+
+static void addr_ref_page(addr_alloc_t *alloc, uint32_t addr)
+{
+    irq_state_t state = spin_lock_irqsave(&alloc->lock);
+
+    int index = (addr - alloc->start) / alloc->page_size;
+    alloc->pages[index].ref++;
+
+    spin_unlock_irqrestore(&alloc->lock, state);
+}
+
+static int addr_page_ref(addr_alloc_t *alloc, uint32_t addr)
+{
+    int index = (addr - alloc->start) / alloc->page_size;
+    return alloc->pages[index].ref;
+}
+
+/**
+ * 物理页所属的分配器
+ */
+static addr_alloc_t *page_zone(uint32_t paddr)
+{
+    return (paddr >= MEM_LOWMEM_END) ? &highmem_alloc : &paddr_alloc;
+}
+
+/**
+ * 释放对物理页的一个引用，页可能位于高端内存
+ */
+void memory_put_page(uint32_t paddr)
+{
+    addr_free_page(page_zone(paddr), paddr, 1);
+}
+
+/**
+ * 更新统计计数，部分路径不持有内核锁，与分配器共用一把锁
+ */
+static void mem_stat_add(uint32_t *counter, int incr)
+{
+    irq_state_t state = spin_lock_irqsave(&paddr_alloc.lock);
+    *counter += incr;
+    spin_unlock_irqrestore(&paddr_alloc.lock, state);
+}
+
+static mem_page_t *addr_to_page(addr_alloc_t *alloc, uint32_t addr)
+{
+    return alloc->pages + (addr - alloc->start) / alloc->page_size;
+}
+
+static uint32_t page_to_addr(addr_alloc_t *alloc, mem_page_t *page)
+{
+    return alloc->start + (page - alloc->pages) * alloc->page_size;
+}
+
+static uint32_t zero_pool_take(void)
+{
+    irq_state_t state = irq_enter_protection();
+
+    list_node_t *node = list_remove_first(&zero_list);
+    if (node)
+        zero_info.hit++;
+    else
+        zero_info.miss++;
+
+    if (list_count(&zero_list) < zero_info.low_mark)
+        zero_refilling = 1;
+
+    irq_leave_protection(state);
+
+    if (node == (list_node_t *)0)
+        return 0;
+
+    return page_to_addr(&paddr_alloc, list_node_parent(node, mem_page_t, node));
+}
+
+static void zero_pool_init(void)
+{
+    list_init(&zero_list);
+    kernel_memset(&zero_info, 0, sizeof(zero_info));
+    zero_info.low_mark = MEM_ZERO_POOL_LOW;
+    zero_info.high_mark = MEM_ZERO_POOL_HIGH;
+    zero_refilling = 1;
+}
+
+/**
+ * @brief 分配一个内容全为0的页，优先从预清零页池中取
+ */
+uint32_t memory_alloc_zero_page(void)
+{
+    uint32_t page = zero_pool_take();
+    if (page)
+        return page;
+
+    page = addr_alloc_page(&paddr_alloc, 1);
+    if (page)
+        kernel_memset((void *)page, 0, MEM_PAGE_SIZE);
+
+    return page;
+}
+
+/**
+ * @brief 由空闲任务调用，每次清零一页放入池中
+ * @return 1 - 补充了一页，0 - 无需补充
+ */
+int memory_zero_pool_refill(void)
+{
+    irq_state_t state = irq_enter_protection();
+    if (list_count(&zero_list) >= zero_info.high_mark)
+        zero_refilling = 0;
+    int refilling = zero_refilling;
+    irq_leave_protection(state);
+
+    if (!refilling)
+        return 0;
+
+    uint32_t page = addr_alloc_page(&paddr_alloc, 1);
+    if (page == 0)
+    {
+        // 与zero_pool_take中的设置在同一临界区保护下修改
+        state = irq_enter_protection();
+        zero_refilling = 0;
+        irq_leave_protection(state);
+        return 0;
+    }
+
+    // 清零时不关中断，随时可被打断
+    kernel_memset((void *)page, 0, MEM_PAGE_SIZE);
+
+    state = irq_enter_protection();
+    list_insert_last(&zero_list, &addr_to_page(&paddr_alloc, page)->node);
+    zero_info.refill++;
+    irq_leave_protection(state);
+    return 1;
+}
+
+void memory_zero_pool_info(mem_zero_info_t *info)
+{
+    irq_state_t state = irq_enter_protection();
+    *info = zero_info;
+    info->count = list_count(&zero_list);
+    irq_leave_protection(state);
+}
+
+void memory_zero_pool_set_mark(int low_mark, int high_mark)
+{
+    irq_state_t state = irq_enter_protection();
+    zero_info.low_mark = low_mark;
+    zero_info.high_mark = high_mark;
+    zero_refilling = list_count(&zero_list) < low_mark;
+    irq_leave_protection(state);
+}
+
+/**
+ * @brief 获取物理页在内核中的访问地址，高端内存中的页临时映射到窗口中
+ * 窗口已满时等待其它使用者释放，不能在中断处理中调用
+ */
+void *memory_kmap(uint32_t paddr)
+{
+    if (paddr < MEM_LOWMEM_END)
+        return (void *)paddr;
+
+    sem_wait(&kmap_sem);
+
+    irq_state_t state = irq_enter_protection();
+    int index = 0;
+    while (kmap_table[index].present)
+        index++;
+    kmap_table[index].v = down2(paddr, MEM_PAGE_SIZE) | PTE_P | PTE_W;
+    irq_leave_protection(state);
+
+    // 其它CPU上的任务使用过该位置时，本CPU的TLB中可能有预取的旧表项
+    uint32_t vaddr = MEM_KMAP_BASE + index * MEM_PAGE_SIZE;
+    invlpg(vaddr);
+    return (void *)(vaddr + (paddr & (MEM_PAGE_SIZE - 1)));
+}
+
+void memory_kunmap(void *vaddr)
+{
+    uint32_t addr = (uint32_t)vaddr;
+    if ((addr < MEM_KMAP_BASE) || (addr >= MEMORY_TASK_BASE - MEM_FIXMAP_NR * MEM_PAGE_SIZE))
+        return;
+
+    // 窗口中的位置会被重复使用，清除表项后立即刷新
+    addr = down2(addr, MEM_PAGE_SIZE);
+    kmap_table[pte_index(addr)].v = 0;
+    invlpg(addr);
+    sem_notify(&kmap_sem);
+}
+
+/**
+ * @brief 将设备寄存器所在的物理页固定映射到窗口顶部，不经过缓存
+ */
+void *memory_fixmap(int index, uint32_t paddr)
+{
+    ASSERT(index < MEM_FIXMAP_NR);
+
+    uint32_t vaddr = MEMORY_TASK_BASE - (index + 1) * MEM_PAGE_SIZE;
+    kmap_table[pte_index(vaddr)].v = down2(paddr, MEM_PAGE_SIZE) | PTE_P | PTE_W | PTE_PCD | PTE_PWT | PTE_G;
+    invlpg(vaddr);
+    return (void *)(vaddr + (paddr & (MEM_PAGE_SIZE - 1)));
+}
+
+/**
+ * 分配一个清零的用户页，优先使用高端内存，把低端内存留给内核
+ */
+static uint32_t user_page_alloc(void)
+{
+    uint32_t page = addr_alloc_page(&highmem_alloc, 1);
+    if (page == 0)
+        return memory_alloc_zero_page();
+
+    void *vaddr = memory_kmap(page);
+    kernel_memset(vaddr, 0, MEM_PAGE_SIZE);
+    memory_kunmap(vaddr);
+    return page;
+}
+
+static mem_region_t *region_alloc(void)
+{
+    mem_region_t *region = (mem_region_t *)kmem_cache_alloc(&region_cache);
+    if (region == (mem_region_t *)0)
+    {
+        log_printf("no free memory region");
+        return (mem_region_t *)0;
+    }
 
-    uint32_t pg_index = (addr - alloc->start) / alloc->page_size;
-    bitmap_set_bit(&alloc->bitmap, pg_index, page_count, 0);
+    kernel_memset(region, 0, sizeof(mem_region_t));
+    return region;
+}
+
+static void region_free(mem_region_t *region)
+{
+    if (region->file)
+        fs_close_file(region->file);
+    if (region->image)
+        image_put(region->image);
 
-    mutex_unlock(&alloc->mutex);
+    kmem_cache_free(&region_cache, region);
 }
 
 void show_mem_info(boot_info_t *boot_info)
@@ -53,13 +444,23 @@ void show_mem_info(boot_info_t *boot_info)
     log_printf("\n");
 }
 
-static uint32_t total_mem_size(boot_info_t *boot_info)
+/**
+ * 包含1MB处的连续内存区域的结束地址，之后的空洞不能当作内存使用
+ */
+static uint32_t ext_mem_end(boot_info_t *boot_info)
 {
-    uint32_t mem_size = 0;
     for (int i = 0; i < boot_info->ram_region_count; i++)
-        mem_size += boot_info->ram_region_cfg[i].size;
+    {
+        uint32_t start = boot_info->ram_region_cfg[i].start;
+        uint32_t size = boot_info->ram_region_cfg[i].size;
+        if ((start > MEM_EXT_START) || (start + size <= MEM_EXT_START))
+            continue;
+
+        // 区域一直延伸到4GB时，结束地址会回绕
+        return (start + size < start) ? down2(0xFFFFFFFF, MEM_PAGE_SIZE) : start + size;
+    }
 
-    return mem_size;
+    return MEM_EXT_START;
 }
 
 pte_t *find_pte(pde_t *page_dir, uint32_t vaddr, int alloc)
@@ -69,6 +470,10 @@ pte_t *find_pte(pde_t *page_dir, uint32_t vaddr, int alloc)
 
     if (pde->present)
     {
+        // 大页没有页表
+        if (pde->ps)
+            return (pte_t *)0;
+
         page_table = (pte_t *)pde_paddr(pde);
     }
     else
@@ -76,14 +481,14 @@ pte_t *find_pte(pde_t *page_dir, uint32_t vaddr, int alloc)
         if (alloc == 0)
             return (pte_t *)0;
 
-        uint32_t pg_paddr = addr_alloc_page(&paddr_alloc, 1);
+        uint32_t pg_paddr = memory_alloc_zero_page();
         if (pg_paddr == 0)
             return (pte_t *)0;
 
         pde->v = pg_paddr | PDE_P | PDE_W | PDE_U;
+        mem_stat_add(&mem_stat.page_table, 1);
 
         page_table = (pte_t *)pg_paddr;
-        kernel_memset(page_table, 0, MEM_PAGE_SIZE);
     }
 
     return page_table + pte_index(vaddr);
@@ -92,26 +497,81 @@ pte_t *find_pte(pde_t *page_dir, uint32_t vaddr, int alloc)
 int memory_create_map(pde_t *page_dir, uint32_t vaddr, uint32_t paddr,
                       int count, uint32_t perm)
 {
-    for (int i = 0; i < count; i++)
+    while (count > 0)
     {
-        // log_printf("create map: v-0x%x, p-0x%x, perm: 0x%x", vaddr, paddr, perm);
         pte_t *pte = find_pte(page_dir, vaddr, 1);
         if (pte == (pte_t *)0)
-        {
-            // log_printf("create pte failed. pte == 0");
             return -1;
+
+        // 一次填完同一页表中的连续表项，不必每页重新查找页表
+        int pte_count = PTE_CNT - pte_index(vaddr);
+        if (pte_count > count)
+            pte_count = count;
+
+        for (int i = 0; i < pte_count; i++, pte++)
+        {
+            ASSERT(pte->present == 0);
+            pte->v = paddr | perm | PTE_P;
+
+            vaddr += MEM_PAGE_SIZE;
+            paddr += MEM_PAGE_SIZE;
+        }
+
+        count -= pte_count;
+    }
+
+    return 0;
+}
+
+/**
+ * 撤销一段地址的映射，free为1时同时释放物理页
+ */
+static void memory_unmap_range(pde_t *page_dir, uint32_t start, uint32_t end, int free)
+{
+    for (uint32_t vaddr = start; vaddr < end; vaddr += MEM_PAGE_SIZE)
+    {
+        pte_t *pte = find_pte(page_dir, vaddr, 0);
+        if ((pte == (pte_t *)0) || !pte->present)
+            continue;
+
+        if (free)
+            memory_put_page(pte_paddr(pte));
+        pte->v = 0;
+    }
+
+    mmu_flush_range((uint32_t)page_dir, start, end);
+}
+
+/**
+ * 内核映射都标记为全局页，4MB对齐的部分直接用大页映射
+ */
+static void create_kernel_map(uint32_t vaddr, uint32_t paddr, int page_count, uint32_t perm)
+{
+    int large_count = MEM_LARGE_PAGE_SIZE / MEM_PAGE_SIZE;
+
+    while (page_count > 0)
+    {
+        pde_t *pde = kernel_page_dir + pde_index(vaddr);
+        if ((((vaddr | paddr) & (MEM_LARGE_PAGE_SIZE - 1)) == 0) &&
+            (page_count >= large_count) && !pde->present)
+        {
+            pde->v = paddr | perm | PDE_P | PDE_PS | PDE_G;
+
+            vaddr += MEM_LARGE_PAGE_SIZE;
+            paddr += MEM_LARGE_PAGE_SIZE;
+            page_count -= large_count;
+            continue;
         }
 
-        // log_printf("pte addr: 0x%x", (uint32_t)pte);
-        ASSERT(pte->present == 0);
-        pte->v = paddr | perm | PTE_P;
+        memory_create_map(kernel_page_dir, vaddr, paddr, 1, perm | PTE_G);
 
         vaddr += MEM_PAGE_SIZE;
         paddr += MEM_PAGE_SIZE;
+        page_count--;
     }
 }
 
-void create_kernel_table(void)
+void create_kernel_table(uint32_t low_end)
 {
     extern uint8_t s_text[], e_text[], s_data[];
     extern uint8_t kernel_base[];
@@ -136,15 +596,22 @@ void create_kernel_table(void)
             PTE_W,
         },
         {
-            (void *)CONSOLE_DISP_ADDR,
-            (void *)CONSOLE_DISP_END,
-            (void *)CONSOLE_DISP_ADDR,
-            PTE_W,
+            // MP表可能位于EBDA或BIOS ROM中，只读映射以便查找
+            (void *)MEM_EBDA_START,
+            (void *)MEM_EBDA_END,
+            (void *)MEM_EBDA_START,
+            0,
         },
         {
+            (void *)MEM_BIOS_START,
             (void *)MEM_EXT_START,
-            (void *)MEM_EXT_END,
-            (void *)MEM_EXT_START,
+            (void *)MEM_BIOS_START,
+            0,
+        },
+        {
+            (void *)CONSOLE_DISP_ADDR,
+            (void *)CONSOLE_DISP_END,
+            (void *)CONSOLE_DISP_ADDR,
             PTE_W,
         },
     };
@@ -158,92 +625,195 @@ void create_kernel_table(void)
         uint32_t paddr = down2((uint32_t)map->pstart, MEM_PAGE_SIZE);
         int page_count = (vend - vstart) / MEM_PAGE_SIZE;
 
-        memory_create_map(kernel_page_dir, vstart,
-                          paddr, page_count, map->perm);
+        create_kernel_map(vstart, paddr, page_count, map->perm);
     }
+
+    // 1MB以上的低端内存一一映射
+    create_kernel_map(MEM_EXT_START, MEM_EXT_START, (low_end - MEM_EXT_START) / MEM_PAGE_SIZE, PTE_W);
+
+    // 临时映射窗口的页表由所有进程共用，表项在使用时才填写
+    kernel_page_dir[pde_index(MEM_KMAP_BASE)].v = (uint32_t)kmap_table | PDE_P | PDE_W;
 }
 
 uint32_t memory_create_uvm(void)
 {
-    pde_t *page_dir = (pde_t *)addr_alloc_page(&paddr_alloc, 1);
+    pde_t *page_dir = (pde_t *)memory_alloc_zero_page();
     if (page_dir == 0)
         return 0;
+    mem_stat_add(&mem_stat.page_table, 1);
 
-    kernel_memset((void *)page_dir, 0, MEM_PAGE_SIZE);
     uint32_t user_pde_start = pde_index(MEMORY_TASK_BASE);
     for (int i = 0; i < user_pde_start; i++)
     {
         page_dir[i].v = kernel_page_dir[i].v;
     }
 
+    // 只读数据页：系统页所有进程共享，进程页放在低端内存，切换时由内核直接写入
+    if (memory_create_map(page_dir, VDATA_ADDR, vdata_page, 1, PTE_U) < 0)
+        goto create_uvm_failed;
+    addr_ref_page(&paddr_alloc, vdata_page);
+
+    uint32_t proc_page = memory_alloc_zero_page();
+    if (proc_page == 0)
+        goto create_uvm_failed;
+
+    if (memory_create_map(page_dir, VDATA_PROC_ADDR, proc_page, 1, PTE_U) < 0)
+    {
+        memory_free_page(proc_page);
+        goto create_uvm_failed;
+    }
+
     return (uint32_t)page_dir;
+
+create_uvm_failed:
+    memory_destroy_uvm((uint32_t)page_dir);
+    return 0;
+}
+
+/**
+ * @brief 系统数据页的内核地址
+ */
+vdata_t *memory_vdata(void)
+{
+    return (vdata_t *)vdata_page;
+}
+
+/**
+ * @brief 记录使用该地址空间的进程，vfork的父子进程共用地址空间，每次切换时重新写入
+ */
+void memory_vdata_set_pid(uint32_t page_dir, int pid)
+{
+    vdata_proc_t *proc = (vdata_proc_t *)memory_get_paddr(page_dir, VDATA_PROC_ADDR);
+    if (proc && (proc->pid != pid))
+        proc->pid = pid;
+}
+
+/**
+ * 只含内核映射的页目录，内核线程首次运行前使用
+ */
+uint32_t memory_kernel_page_dir(void)
+{
+    return (uint32_t)kernel_page_dir;
 }
 
 void memory_init(boot_info_t *boot_info)
 {
-    extern uint8_t *mem_free_start;
     log_printf("mem init");
 
     show_mem_info(boot_info);
-    uint8_t *mem_free = (uint8_t *)&mem_free_start;
 
-    uint32_t mem_up1MB_free = total_mem_size(boot_info) - MEM_EXT_START;
-    mem_up1MB_free = down2(mem_up1MB_free, MEM_PAGE_SIZE);
-    log_printf("free memory: 0x%x, size: 0x%x", MEM_EXT_START, mem_up1MB_free);
+    // 超出低端内存的部分作为高端内存，其页描述表放在低端内存的末尾
+    uint32_t mem_end = down2(ext_mem_end(boot_info), MEM_PAGE_SIZE);
+    uint32_t low_end = (mem_end > MEM_LOWMEM_END) ? MEM_LOWMEM_END : mem_end;
+    uint32_t high_size = mem_end - low_end;
+    uint32_t high_desc = down2(low_end - high_size / MEM_PAGE_SIZE * sizeof(mem_page_t), MEM_PAGE_SIZE);
+    log_printf("low memory: 0x%x - 0x%x, high memory size: 0x%x", MEM_EXT_START, high_desc, high_size);
+
+    addr_alloc_init(&paddr_alloc, (mem_page_t *)MEM_EXT_START, MEM_EXT_START,
+                    high_desc - MEM_EXT_START, MEM_PAGE_SIZE);
+    addr_alloc_init(&highmem_alloc, (mem_page_t *)high_desc, MEM_LOWMEM_END, high_size, MEM_PAGE_SIZE);
+    sem_init(&kmap_sem, MEM_KMAP_NR - MEM_FIXMAP_NR);
+    zero_pool_init();
+    kmem_init();
+    kmem_cache_init(&region_cache, "mem_region", sizeof(mem_region_t), 0);
+
+    create_kernel_table(low_end);
+    write_cr4(read_cr4() | CR4_PSE);
+    mmu_set_page_dir((uint32_t)kernel_page_dir);
 
-    addr_alloc_init(&paddr_alloc, mem_free, MEM_EXT_START,
-                    mem_up1MB_free, MEM_PAGE_SIZE);
-    mem_free += bitmap_byte_count(paddr_alloc.size / MEM_PAGE_SIZE);
+    // 内核映射在所有进程中相同，设为全局页后切换进程时不必重新加载
+    write_cr4(read_cr4() | CR4_PGE);
 
-    ASSERT(mem_free < (uint8_t *)MEM_EBDA_START);
+    // 开启写保护，内核写入只读的写时复制页时也能进入缺页处理
+    write_cr0(read_cr0() | CR0_WP);
 
-    create_kernel_table();
-    mmu_set_page_dir((uint32_t)kernel_page_dir);
+    vdata_page = memory_alloc_zero_page();
+    ASSERT(vdata_page != 0);
 }
 
+/**
+ * @brief 为一段地址分配物理页并建立映射
+ * 尽量成块分配物理上连续的页，内存碎片多时再逐步减小块的大小
+ * 中途失败时撤销已建立的映射并释放已分配的页
+ */
 uint32_t memory_alloc_for_page_dir(uint32_t page_dir, uint32_t vaddr, uint32_t size, int perm)
 {
-    uint32_t curr_vaddr = vaddr;
-    int page_count = up2(size, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
-    vaddr = down2(vaddr, MEM_PAGE_SIZE);
+    uint32_t start = down2(vaddr, MEM_PAGE_SIZE);
+    uint32_t end = up2(vaddr + size, MEM_PAGE_SIZE);
+    int max_count = 1 << (MEM_BUDDY_ORDER_NR - 1);
 
-    for (int i = 0; i < page_count; i++)
+    uint32_t curr = start;
+    while (curr < end)
     {
-        uint32_t paddr = addr_alloc_page(&paddr_alloc, 1);
+        int count = (end - curr) / MEM_PAGE_SIZE;
+        if (count > max_count)
+            count = max_count;
+
+        uint32_t paddr = 0;
+        for (; count > 0; count >>= 1)
+        {
+            paddr = addr_alloc_page(&paddr_alloc, count);
+            if (paddr)
+                break;
+        }
+
         if (paddr == 0)
         {
             log_printf("mem alloc failed. no memory");
-            return -1;
+            goto alloc_failed;
         }
 
-        int err = memory_create_map((pde_t *)page_dir, curr_vaddr, paddr, 1, perm);
-
+        int err = memory_create_map((pde_t *)page_dir, curr, paddr, count, perm);
         if (err < 0)
         {
+            // 本块可能只映射了一部分，先清除表项再整块释放
             log_printf("create memory failed. err = %d", err);
-            return -1;
+            memory_unmap_range((pde_t *)page_dir, curr, curr + count * MEM_PAGE_SIZE, 0);
+            addr_free_page(&paddr_alloc, paddr, count);
+            goto alloc_failed;
         }
 
-        curr_vaddr += MEM_PAGE_SIZE;
+        curr += count * MEM_PAGE_SIZE;
     }
 
     return 0;
+
+alloc_failed:
+    memory_unmap_range((pde_t *)page_dir, start, curr, 1);
+    return -1;
 }
 
 int memory_alloc_page_for(uint32_t addr, uint32_t size, int perm)
 {
-    return memory_alloc_for_page_dir(task_current()->tss.cr3, addr, size, perm);
+    return memory_alloc_for_page_dir(task_current()->cr3, addr, size, perm);
 }
 
 uint32_t memory_alloc_page(void)
 {
     uint32_t addr = addr_alloc_page(&paddr_alloc, 1);
+
+    // 内存不足时，池中预清零的页也可以使用
+    if (addr == 0)
+        addr = zero_pool_take();
     return addr;
 }
 
+/**
+ * 分配物理上连续的多个页，如用作DMA缓冲区
+ */
+uint32_t memory_alloc_pages(int page_count)
+{
+    return addr_alloc_page(&paddr_alloc, page_count);
+}
+
+void memory_free_pages(uint32_t addr, int page_count)
+{
+    addr_free_page(&paddr_alloc, addr, page_count);
+}
+
 static pde_t *curr_page_dir(void)
 {
-    return (pde_t *)task_current()->tss.cr3;
+    return (pde_t *)task_current()->cr3;
 }
 
 void memory_free_page(uint32_t addr)
@@ -257,8 +827,9 @@ void memory_free_page(uint32_t addr)
         pte_t *pte = find_pte(curr_page_dir(), addr, 0);
         ASSERT(pte != (pte_t *)0 && pte->present);
 
-        addr_free_page(&paddr_alloc, pte_paddr(pte), 1);
+        memory_put_page(pte_paddr(pte));
         pte->v = 0;
+        mmu_flush_page((uint32_t)curr_page_dir(), addr);
     }
 }
 
@@ -278,13 +849,25 @@ void memory_destroy_uvm(uint32_t page_dir)
             if (!pte->present)
                 continue;
 
-            addr_free_page(&paddr_alloc, pte_paddr(pte), 1);
+            memory_put_page(pte_paddr(pte));
         }
 
         addr_free_page(&paddr_alloc, (uint32_t)pde_paddr(pde), 1);
+        mem_stat_add(&mem_stat.page_table, -1);
+        pde->v = 0;
     }
 
+    // 当前CPU或其它CPU上的内核线程可能还在借用，只剩内核映射，借用者切换走后再释放
+    if (read_cr3() == page_dir)
+        mmu_set_page_dir(memory_kernel_page_dir());
+    if (!task_defer_page_dir(page_dir))
+        memory_free_page_dir(page_dir);
+}
+
+void memory_free_page_dir(uint32_t page_dir)
+{
     addr_free_page(&paddr_alloc, page_dir, 1);
+    mem_stat_add(&mem_stat.page_table, -1);
 }
 
 uint32_t memory_copy_uvm(uint32_t page_dir)
@@ -301,115 +884,1104 @@ uint32_t memory_copy_uvm(uint32_t page_dir)
         if (!pde->present)
             continue;
 
+        // 子进程的页表每个目录项只查找一次，表项直接逐项复制
         pte_t *pte = (pte_t *)pde_paddr(pde);
-        for (int j = 0; j < PTE_CNT; j++, pte++)
+        pte_t *to_pte = find_pte((pde_t *)to_page_dir, (uint32_t)i << 22, 1);
+        if (to_pte == (pte_t *)0)
+            goto copy_uvm_failed;
+
+        int shared = 0;
+        for (int j = 0; j < PTE_CNT; j++, pte++, to_pte++)
         {
-            if (!pte->present)
+            // 只读数据页在创建地址空间时已映射，子进程使用自己的进程页
+            if (!pte->present || to_pte->present)
                 continue;
 
-            uint32_t page = addr_alloc_page(&paddr_alloc, 1);
-            if (page == 0)
-                goto copy_uvm_failed;
-
-            uint32_t vaddr = (i << 22) | (j << 12);
-            int err = memory_create_map((pde_t *)to_page_dir, vaddr,
-                                        page, 1, get_pte_perm(pte));
-            if (err < 0)
-                goto copy_uvm_failed;
+            // 不复制页面内容，父子进程共享同一物理页，可写页改为只读并标记为写时复制
+            // 共享映射的页保持可写，双方的写入互相可见
+            if ((pte->v & PTE_W) && !(pte->v & PTE_SHARED))
+                pte->v = (pte->v & ~PTE_W) | PTE_COW;
 
-            kernel_memcpy((void *)page, (void *)vaddr, MEM_PAGE_SIZE);
+            uint32_t paddr = pte_paddr(pte);
+            to_pte->v = paddr | get_pte_perm(pte);
+            addr_ref_page(page_zone(paddr), paddr);
+            shared++;
         }
+        mem_stat_add(&mem_stat.fork_share, shared);
     }
 
+    // 父进程的页表项已被改为只读，刷新TLB
+    if (page_dir == read_cr3())
+        mmu_set_page_dir(page_dir);
+
     return to_page_dir;
 
 copy_uvm_failed:
     if (to_page_dir)
         memory_destroy_uvm(to_page_dir);
-    return -1;
-}
-
-uint32_t memory_get_paddr(uint32_t page_dir, uint32_t vaddr)
-{
-    pte_t *pte = find_pte((pde_t *)page_dir, vaddr, 0);
-    if (!pte)
-        return 0;
 
-    return pte_paddr(pte) + (vaddr & (MEM_PAGE_SIZE - 1));
+    if (page_dir == read_cr3())
+        mmu_set_page_dir(page_dir);
+    return 0;
 }
 
-int memory_copy_uvm_data(uint32_t to,
-                         uint32_t page_dir,
-                         uint32_t from,
-                         uint32_t size)
+/**
+ * 复制物理页。至少一个在低端内存时直接访问，只占用一个窗口
+ * 都在高端内存时经栈上的缓冲分段复制，映射窗口时可能等待，不同时持有两个窗口
+ */
+static void memory_copy_page(uint32_t to, uint32_t from)
 {
-    while (size > 0)
+    if ((to < MEM_LOWMEM_END) || (from < MEM_LOWMEM_END))
     {
-        uint32_t to_paddr = memory_get_paddr(page_dir, to);
-        if (to_paddr == 0)
-            return -1;
-
-        uint32_t offset_in_page = to_paddr & (MEM_PAGE_SIZE - 1);
-        uint32_t curr_size = MEM_PAGE_SIZE - offset_in_page;
-        if (curr_size > size)
-            curr_size = size;
+        void *to_vaddr = memory_kmap(to);
+        void *from_vaddr = memory_kmap(from);
+        kernel_memcpy(to_vaddr, from_vaddr, MEM_PAGE_SIZE);
+        memory_kunmap(from_vaddr);
+        memory_kunmap(to_vaddr);
+        return;
+    }
 
-        kernel_memcpy((void *)to_paddr, (void *)from, curr_size);
+    char buf[MEM_KMAP_COPY_SIZE];
+    for (uint32_t offset = 0; offset < MEM_PAGE_SIZE; offset += sizeof(buf))
+    {
+        void *vaddr = memory_kmap(from + offset);
+        kernel_memcpy(buf, vaddr, sizeof(buf));
+        memory_kunmap(vaddr);
 
-        size -= curr_size;
-        to += curr_size;
-        from += curr_size;
+        vaddr = memory_kmap(to + offset);
+        kernel_memcpy(vaddr, buf, sizeof(buf));
+        memory_kunmap(vaddr);
     }
-
-    return 0;
 }
 
-char *sys_sbrk(int incr)
+/**
+ * 写时复制：页仍被共享则复制一份，否则直接恢复写权限
+ */
+static int memory_copy_on_write(pte_t *pte)
 {
+    uint32_t paddr = pte_paddr(pte);
+    uint32_t perm = (get_pte_perm(pte) & ~PTE_COW) | PTE_W;
+
+    if (addr_page_ref(page_zone(paddr), paddr) == 1)
+    {
+        pte->v = paddr | perm;
+        return 0;
+    }
+
+    // 副本优先放在与原页不同的区域，复制时只需映射其中一个
+    addr_alloc_t *zone = (page_zone(paddr) == &highmem_alloc) ? &paddr_alloc : &highmem_alloc;
+    uint32_t page = addr_alloc_page(zone, 1);
+    if (page == 0)
+        page = addr_alloc_page((zone == &paddr_alloc) ? &highmem_alloc : &paddr_alloc, 1);
+    if (page == 0)
+    {
+        log_printf("copy on write failed. no memory");
+        return -1;
+    }
+
+    memory_copy_page(page, paddr);
+
+    mem_stat_add(&mem_stat.cow_copy, 1);
+    task_current_proc()->cow_copy++;
+    pte->v = page | perm;
+    memory_put_page(paddr);
+    return 0;
+}
+
+mem_region_t *memory_add_region(list_t *region_list, uint32_t start,
+                                uint32_t end, uint32_t perm)
+{
+    mem_region_t *region = region_alloc();
+    if (region == (mem_region_t *)0)
+        return (mem_region_t *)0;
+
+    region->start = down2(start, MEM_PAGE_SIZE);
+    region->end = up2(end, MEM_PAGE_SIZE);
+    region->perm = perm;
+    region->type = MEM_REGION_ANON;
+    list_insert_last(region_list, &region->node);
+    return region;
+}
+
+mem_region_t *memory_add_file_region(list_t *region_list, uint32_t vaddr,
+                                     uint32_t mem_size, uint32_t perm, file_t *file,
+                                     uint32_t offset, uint32_t file_size)
+{
+    mem_region_t *region = memory_add_region(region_list, vaddr, vaddr + mem_size, perm);
+    if (region == (mem_region_t *)0)
+        return (mem_region_t *)0;
+
+    file_inc_ref(file);
+    region->type = MEM_REGION_FILE;
+    region->file = file;
+    region->file_offset = offset;
+    region->file_vaddr = vaddr;
+    region->file_size = file_size;
+    return region;
+}
+
+mem_region_t *memory_find_region(list_t *region_list, uint32_t vaddr)
+{
+    list_node_t *node = list_first(region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        if ((vaddr >= region->start) && (vaddr < region->end))
+            return region;
+
+        node = list_node_next(node);
+    }
+
+    return (mem_region_t *)0;
+}
+
+int memory_copy_regions(list_t *to, list_t *from)
+{
+    list_node_t *node = list_first(from);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        mem_region_t *copy = region_alloc();
+        if (copy == (mem_region_t *)0)
+            return -1;
+
+        kernel_memcpy(copy, region, sizeof(mem_region_t));
+        if (copy->file)
+            file_inc_ref(copy->file);
+        if (copy->image)
+            image_inc_ref(copy->image);
+        list_insert_last(to, &copy->node);
+
+        node = list_node_next(node);
+    }
+
+    return 0;
+}
+
+void memory_free_regions(list_t *region_list)
+{
+    list_node_t *node;
+    while ((node = list_remove_first(region_list)) != (list_node_t *)0)
+        region_free(list_node_parent(node, mem_region_t, node));
+}
+
+/**
+ * 填充一页内容：页已预先清零，只需从覆盖该页的各文件区域读入数据
+ * 一页中可能同时包含多个段的内容，如代码段的末尾与数据段的开头
+ */
+static int memory_fill_page(list_t *region_list, uint32_t page, uint32_t vaddr)
+{
+    list_node_t *node = list_first(region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        node = list_node_next(node);
+
+        if (region->type != MEM_REGION_FILE)
+            continue;
+
+        // 区域可能已被munmap截短，只读取仍在区域内的部分
+        uint32_t start = (vaddr > region->file_vaddr) ? vaddr : region->file_vaddr;
+        if (start < region->start)
+            start = region->start;
+
+        uint32_t end = region->file_vaddr + region->file_size;
+        if (end > vaddr + MEM_PAGE_SIZE)
+            end = vaddr + MEM_PAGE_SIZE;
+        if (end > region->end)
+            end = region->end;
+
+        if (start >= end)
+            continue;
+
+        int size = end - start;
+        int cnt = fs_read_file(region->file, region->file_offset + (start - region->file_vaddr),
+                               (char *)(page + (start - vaddr)), size);
+        if (cnt < size)
+        {
+            log_printf("load page failed. vaddr: 0x%x", vaddr);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * 获取覆盖某页的各区域的权限，页可能同时属于多个段
+ * 各区域都来自同一映像的只读段时，返回该映像，页可在进程间共享
+ */
+static uint32_t page_region_perm(list_t *region_list, uint32_t vaddr, image_t **image)
+{
+    uint32_t perm = 0;
+    int shareable = 1;
+
+    *image = (image_t *)0;
+
+    list_node_t *node = list_first(region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        node = list_node_next(node);
+
+        if ((vaddr + MEM_PAGE_SIZE <= region->start) || (vaddr >= region->end))
+            continue;
+
+        perm |= region->perm;
+        if (!region->image || (region->perm & PTE_W) || (*image && (*image != region->image)))
+            shareable = 0;
+        *image = region->image;
+    }
+
+    if (!shareable)
+        *image = (image_t *)0;
+    return perm;
+}
+
+/**
+ * 为区域中的某个虚拟页分配物理页并填充内容
+ */
+static int memory_load_page(list_t *region_list, pde_t *page_dir, uint32_t vaddr)
+{
+    vaddr = down2(vaddr, MEM_PAGE_SIZE);
+
+    mem_region_t *region = memory_find_region(region_list, vaddr);
+    if (region == (mem_region_t *)0)
+        return -1;
+
+    image_t *image;
+    uint32_t perm = page_region_perm(region_list, vaddr, &image);
+
+    // 映像中的页按所在的文件页索引，段的起始地址与文件偏移按页对齐，虚拟页的起始处对应文件页的起始处
+    uint32_t offset = 0;
+    if (image)
+    {
+        if (vaddr >= region->file_vaddr)
+            offset = region->file_offset + (vaddr - region->file_vaddr);
+        else if (region->file_offset >= region->file_vaddr - vaddr)
+            offset = region->file_offset - (region->file_vaddr - vaddr);
+    }
+
+    // 其它进程已装入过该页时直接映射，只读，无需再读文件
+    uint32_t page = image ? image_find_page(image, offset, vaddr) : 0;
+    if (page)
+    {
+        addr_ref_page(page_zone(page), page);
+    }
+    else
+    {
+        page = user_page_alloc();
+        if (page == 0)
+        {
+            log_printf("load page failed. no memory");
+            return -1;
+        }
+
+        void *kaddr = memory_kmap(page);
+        int err = memory_fill_page(region_list, (uint32_t)kaddr, vaddr);
+        memory_kunmap(kaddr);
+        if (err < 0)
+        {
+            memory_put_page(page);
+            return -1;
+        }
+
+        // 加入映像后缓存也持有一个引用
+        uint32_t cached = image ? image_add_page(image, offset, vaddr, page) : 0;
+        if (cached)
+        {
+            page = cached;
+            addr_ref_page(page_zone(page), page);
+        }
+    }
+
+    if (memory_create_map(page_dir, vaddr, page, 1, perm) < 0)
+    {
+        memory_put_page(page);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * 预先装入一段用户地址对应的页
+ * 文件系统在持有锁时访问用户缓冲区，不能在其中再因缺页去读文件，因此需提前调入
+ */
+int memory_fault_in(uint32_t vaddr, uint32_t size)
+{
+    if ((vaddr < MEMORY_TASK_BASE) || (size == 0))
+        return 0;
+
+    task_t *task = task_current_proc();
+    pde_t *page_dir = (pde_t *)task->cr3;
+
+    uint32_t end = vaddr + size;
+    for (uint32_t page = down2(vaddr, MEM_PAGE_SIZE); page < end; page += MEM_PAGE_SIZE)
+    {
+        pte_t *pte = find_pte(page_dir, page, 0);
+        if (pte && pte->present)
+            continue;
+
+        if (memory_load_page(&task->region_list, page_dir, page) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 取当前进程中用户地址对应的物理地址，用于在进程间标识同一位置
+ * 页不存在时先装入，写时复制的页先复制，之后的写入不会再换到其它物理页
+ */
+uint32_t memory_user_paddr(uint32_t vaddr)
+{
+    if ((vaddr < MEMORY_TASK_BASE) || (memory_fault_in(vaddr, sizeof(uint32_t)) < 0))
+        return 0;
+
     task_t *task = task_current();
+    pte_t *pte = find_pte((pde_t *)task->cr3, vaddr, 0);
+    if ((pte == (pte_t *)0) || !pte->present)
+        return 0;
+
+    if (pte->v & PTE_COW)
+    {
+        int err = memory_copy_on_write(pte);
+        mmu_flush_page(task->cr3, vaddr);
+        if (err < 0)
+            return 0;
+    }
+
+    return pte_paddr(pte) + (vaddr & (MEM_PAGE_SIZE - 1));
+}
+
+/**
+ * @brief 检查一段用户地址的页都已映射且用户可访问，write时还需可写，不修改页表
+ */
+int memory_user_check(uint32_t vaddr, uint32_t size, int write)
+{
+    if ((vaddr < MEMORY_TASK_BASE) || (vaddr + size < vaddr))
+        return -1;
+
+    pde_t *page_dir = (pde_t *)task_current_proc()->cr3;
+    for (uint32_t page = down2(vaddr, MEM_PAGE_SIZE); page < vaddr + size; page += MEM_PAGE_SIZE)
+    {
+        pte_t *pte = find_pte(page_dir, page, 0);
+        if ((pte == (pte_t *)0) || !pte->present || !(pte->v & PTE_U))
+            return -1;
+
+        if (write && !(pte->v & PTE_W))
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 在进程自己的上下文中装入一段用户地址，write时先做写时复制，之后检查能否访问
+ * 内核线程代进程访问这段地址时只需检查，不会再因缺页修改进程的页表
+ */
+int memory_user_prepare(uint32_t vaddr, uint32_t size, int write)
+{
+    if ((vaddr < MEMORY_TASK_BASE) || (vaddr + size < vaddr))
+        return -1;
+
+    if (memory_fault_in(vaddr, size) < 0)
+        return -1;
+
+    task_t *task = task_current_proc();
+    for (uint32_t page = down2(vaddr, MEM_PAGE_SIZE); write && (page < vaddr + size); page += MEM_PAGE_SIZE)
+    {
+        pte_t *pte = find_pte((pde_t *)task->cr3, page, 0);
+        if (pte && pte->present && (pte->v & PTE_COW))
+        {
+            int err = memory_copy_on_write(pte);
+            mmu_flush_page(task->cr3, page);
+            if (err < 0)
+                return -1;
+        }
+    }
+
+    return memory_user_check(vaddr, size, write);
+}
+
+/**
+ * 共享映射在fork前全部调入，使父子进程引用同一组物理页
+ */
+int memory_fault_in_shared(list_t *region_list)
+{
+    list_node_t *node = list_first(region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        if ((region->flags & MEM_REGION_SHARED) &&
+            (memory_fault_in(region->start, region->end - region->start) < 0))
+        {
+            return -1;
+        }
+
+        node = list_node_next(node);
+    }
+
+    return 0;
+}
+
+/**
+ * 共享的文件映射中被写过的页写回文件
+ */
+static void region_write_back(mem_region_t *region, uint32_t vaddr, pte_t *pte)
+{
+    if (!(region->flags & MEM_REGION_SHARED) || (region->type != MEM_REGION_FILE) || !pte->dirty)
+        return;
+
+    // 只写回文件原有的范围，不扩大文件
+    uint32_t start = (vaddr > region->file_vaddr) ? vaddr : region->file_vaddr;
+    uint32_t end = region->file_vaddr + region->file_size;
+    if (end > vaddr + MEM_PAGE_SIZE)
+        end = vaddr + MEM_PAGE_SIZE;
+
+    if (start >= end)
+        return;
+
+    int size = end - start;
+    char *page = (char *)memory_kmap(pte_paddr(pte));
+    int cnt = fs_write_file(region->file, region->file_offset + (start - region->file_vaddr),
+                            page + (start - vaddr), size);
+    memory_kunmap(page);
+    if (cnt < size)
+        log_printf("write back page failed. vaddr: 0x%x", vaddr);
+}
+
+/**
+ * 进程退出或替换地址空间前，将共享文件映射的修改写回
+ */
+void memory_sync_regions(list_t *region_list, uint32_t page_dir)
+{
+    list_node_t *node = list_first(region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        node = list_node_next(node);
+
+        if (!(region->flags & MEM_REGION_SHARED) || (region->type != MEM_REGION_FILE))
+            continue;
+
+        for (uint32_t vaddr = region->start; vaddr < region->end; vaddr += MEM_PAGE_SIZE)
+        {
+            pte_t *pte = find_pte((pde_t *)page_dir, vaddr, 0);
+            if (pte && pte->present)
+                region_write_back(region, vaddr, pte);
+        }
+    }
+}
+
+int memory_handle_page_fault(uint32_t vaddr, int err_code)
+{
+    if (vaddr < MEMORY_TASK_BASE)
+        return -1;
+
+    task_t *task = task_current_proc();
+    pde_t *page_dir = (pde_t *)task->cr3;
+
+    mem_stat_add(&mem_stat.page_fault, 1);
+    task->page_fault++;
+
+    // 页不存在：按需从所属区域中装入
+    if (!(err_code & ERR_PAGE_P))
+        return memory_load_page(&task->region_list, page_dir, vaddr);
+
+    if (err_code & ERR_PAGE_WR)
+    {
+        pte_t *pte = find_pte(page_dir, vaddr, 0);
+        if (pte && pte->present && (pte->v & PTE_COW))
+        {
+            int err = memory_copy_on_write(pte);
+            mmu_flush_page((uint32_t)page_dir, vaddr);
+            return err;
+        }
+    }
+
+    return -1;
+}
+
+uint32_t memory_get_paddr(uint32_t page_dir, uint32_t vaddr)
+{
+    pte_t *pte = find_pte((pde_t *)page_dir, vaddr, 0);
+    if (!pte)
+        return 0;
+
+    return pte_paddr(pte) + (vaddr & (MEM_PAGE_SIZE - 1));
+}
+
+int memory_copy_uvm_data(uint32_t to,
+                         uint32_t page_dir,
+                         uint32_t from,
+                         uint32_t size)
+{
+    while (size > 0)
+    {
+        uint32_t to_paddr = memory_get_paddr(page_dir, to);
+        if (to_paddr == 0)
+            return -1;
+
+        uint32_t offset_in_page = to_paddr & (MEM_PAGE_SIZE - 1);
+        uint32_t curr_size = MEM_PAGE_SIZE - offset_in_page;
+        if (curr_size > size)
+            curr_size = size;
+
+        // 目标页可能位于高端内存，不能直接按物理地址访问
+        void *to_vaddr = memory_kmap(to_paddr);
+        kernel_memcpy(to_vaddr, (void *)from, curr_size);
+        memory_kunmap(to_vaddr);
+
+        size -= curr_size;
+        to += curr_size;
+        from += curr_size;
+    }
+
+    return 0;
+}
+
+static mem_region_t *region_overlap(list_t *region_list, uint32_t start, uint32_t end,
+                                    mem_region_t *exclude)
+{
+    list_node_t *node = list_first(region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        node = list_node_next(node);
+
+        if (region == exclude)
+            continue;
+
+        if ((region->start < end) && (start < region->end))
+            return region;
+
+        // 空的堆区域也要占住其起始地址，以便堆继续增长
+        if ((region->start == region->end) && (region->start >= start) && (region->start < end))
+            return region;
+    }
+
+    return (mem_region_t *)0;
+}
+
+static mem_region_t *heap_region(task_t *task)
+{
+    list_node_t *node = list_first(&task->region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        if (region->flags & MEM_REGION_HEAP)
+            return region;
+
+        node = list_node_next(node);
+    }
+
+    return (mem_region_t *)0;
+}
+
+static char *heap_resize(task_t *task, int incr)
+{
     char *pre_heap_end = (char *)task->heap_end;
-    ASSERT(incr >= 0);
 
-    int pre_incr = incr;
     if (incr == 0)
     {
-        log_printf("sbrk(0): end=0x%x\n", pre_heap_end);
+        log_debug("sbrk(0): end=0x%x", pre_heap_end);
         return pre_heap_end;
     }
 
-    uint32_t start = task->heap_end;
-    uint32_t end = start + incr;
+    mem_region_t *region = heap_region(task);
+    if (region == (mem_region_t *)0)
+    {
+        log_printf("sbrk: no heap region.");
+        return (char *)-1;
+    }
 
-    // 0x81001024 - 0x81001048
-    // 0x81001000
-    int start_offset = start % MEM_PAGE_SIZE; // 0x24
-    if (start_offset)
+    if (incr < 0)
     {
-        if (start_offset + incr <= MEM_PAGE_SIZE)
+        if ((uint32_t)-incr > task->heap_end - task->heap_start)
         {
-            task->heap_end = end; // 0x81001048
-            return pre_heap_end;
+            log_printf("sbrk: heap underflow.");
+            return (char *)-1;
+        }
+
+        // 新的结束位置之后的整页解除映射并释放，所在的页仍在使用
+        uint32_t end = task->heap_end + incr;
+        uint32_t region_end = up2(end, MEM_PAGE_SIZE);
+        if (region_end < region->start)
+            region_end = region->start;
+
+        ring_pause(task);
+        memory_unmap_range((pde_t *)task->cr3, region_end, region->end, 1);
+        region->end = region_end;
+        ring_resume(task);
+
+        log_debug("sbrk(%d): end=0x%x", incr, end);
+        task->heap_end = end;
+        return pre_heap_end;
+    }
+
+    // 只扩大堆区域的范围，物理页在首次访问时才分配
+    uint32_t end = task->heap_end + incr;
+    if (end > MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE)
+    {
+        log_printf("sbrk: heap overflow.");
+        return (char *)-1;
+    }
+
+    // 不能与上方的mmap区域重叠
+    if ((up2(end, MEM_PAGE_SIZE) > region->end) &&
+        region_overlap(&task->region_list, region->end, up2(end, MEM_PAGE_SIZE), region))
+    {
+        log_printf("sbrk: heap overflow.");
+        return (char *)-1;
+    }
+
+    region->end = up2(end, MEM_PAGE_SIZE);
+
+    log_debug("sbrk(%d): end=0x%x", incr, end);
+    task->heap_end = end;
+    return (char *)pre_heap_end;
+}
+
+/**
+ * @brief 调整堆的大小，incr为负时缩小，释放不再使用的整页
+ * 扩大只修改本进程的区域，不持内核锁。缩小时释放的页可能与其它进程共享，
+ * 有队列线程时它会同时访问区域，这两种情况下持锁
+ */
+char *sys_sbrk(int incr)
+{
+    task_t *task = task_current();
+
+    int lock = (incr < 0) || task->ring;
+    if (lock)
+        irq_lock_kernel();
+
+    char *pre_heap_end = heap_resize(task, incr);
+
+    if (lock)
+        irq_unlock_kernel();
+    return pre_heap_end;
+}
+
+/**
+ * 在栈的下方从高向低查找足够大的空闲地址范围
+ */
+static uint32_t mmap_find_area(list_t *region_list, uint32_t size)
+{
+    uint32_t end = MEM_TASK_MMAP_TOP;
+    while (end >= MEMORY_TASK_BASE + size)
+    {
+        mem_region_t *region = region_overlap(region_list, end - size, end, (mem_region_t *)0);
+        if (region == (mem_region_t *)0)
+            return end - size;
+
+        end = region->start;
+    }
+
+    return 0;
+}
+
+/**
+ * 确定新映射的地址：vaddr为0时自动查找，否则检查指定的地址是否可用
+ */
+static uint32_t mmap_get_area(list_t *region_list, uint32_t vaddr, uint32_t size)
+{
+    if (vaddr == 0)
+        return mmap_find_area(region_list, size);
+
+    // 与已有区域重叠时直接失败，不替换原有映射
+    if ((vaddr & (MEM_PAGE_SIZE - 1)) || (vaddr < MEMORY_TASK_BASE) ||
+        (vaddr + size > MEM_TASK_MMAP_TOP) || (vaddr + size < vaddr) ||
+        region_overlap(region_list, vaddr, vaddr + size, (mem_region_t *)0))
+    {
+        return 0;
+    }
+
+    return vaddr;
+}
+
+/**
+ * @brief 建立映射，页在首次访问时才装入
+ * MAP_SHARED的页只在fork出的父子进程间共享，各自独立映射同一文件的进程使用各自的页，
+ * 修改过的页在munmap、退出或execve时才写回文件，此后映射的进程才能看到
+ */
+int sys_mmap(mmap_args_t *args)
+{
+    task_t *task = task_current();
+
+    uint32_t size = up2(args->length, MEM_PAGE_SIZE);
+    int shared = args->flags & MAP_SHARED;
+    if ((size == 0) || (args->offset & (MEM_PAGE_SIZE - 1)) ||
+        (shared == 0) == ((args->flags & MAP_PRIVATE) == 0))
+    {
+        log_printf("mmap: invalid argument.");
+        return -1;
+    }
+
+    file_t *file = (file_t *)0;
+    if (!(args->flags & MAP_ANONYMOUS))
+    {
+        file = task_file(args->fd);
+        if ((file == (file_t *)0) || (file->type != FILE_NORMAL))
+        {
+            log_printf("mmap: bad file %d", args->fd);
+            return -1;
+        }
+
+        if (shared && (args->prot & PROT_WRITE) && (file->mode == O_RDONLY))
+        {
+            log_printf("mmap: file not writable.");
+            return -1;
+        }
+    }
+
+    uint32_t start = mmap_get_area(&task->region_list,
+                                   (args->flags & MAP_FIXED) ? (uint32_t)args->addr : 0, size);
+    if (start == 0)
+    {
+        log_printf("mmap: no free address space.");
+        return -1;
+    }
+
+    uint32_t perm = PTE_P | PTE_U;
+    if (args->prot & PROT_WRITE)
+        perm |= PTE_W;
+    if (shared)
+        perm |= PTE_SHARED;
+
+    mem_region_t *region;
+    if (file)
+    {
+        uint32_t file_size = 0;
+        if (args->offset < file->size)
+            file_size = file->size - args->offset;
+        if (file_size > size)
+            file_size = size;
+
+        region = memory_add_file_region(&task->region_list, start, size, perm,
+                                        file, args->offset, file_size);
+    }
+    else
+    {
+        region = memory_add_region(&task->region_list, start, start + size, perm);
+    }
+
+    if (region == (mem_region_t *)0)
+        return -1;
+
+    region->flags = MEM_REGION_MMAP | (shared ? MEM_REGION_SHARED : 0);
+    return start;
+}
+
+static void region_unmap_pages(mem_region_t *region, pde_t *page_dir, uint32_t start, uint32_t end)
+{
+    for (uint32_t vaddr = start; vaddr < end; vaddr += MEM_PAGE_SIZE)
+    {
+        pte_t *pte = find_pte(page_dir, vaddr, 0);
+        if ((pte == (pte_t *)0) || !pte->present)
+            continue;
+
+        region_write_back(region, vaddr, pte);
+        memory_put_page(pte_paddr(pte));
+        pte->v = 0;
+    }
+
+    mmu_flush_range((uint32_t)page_dir, start, end);
+}
+
+int sys_munmap(uint32_t addr, uint32_t length)
+{
+    if ((addr & (MEM_PAGE_SIZE - 1)) || (length == 0))
+        return -1;
+
+    task_t *task = task_current();
+    pde_t *page_dir = (pde_t *)task->cr3;
+    uint32_t end = up2(addr + length, MEM_PAGE_SIZE);
+    int err = 0;
+
+    // 队列线程可能正在读写其中的页
+    ring_pause(task);
+
+    list_node_t *node = list_first(&task->region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        node = list_node_next(node);
+
+        if (!(region->flags & MEM_REGION_MMAP) || (region->end <= addr) || (region->start >= end))
+            continue;
+
+        uint32_t start = (addr > region->start) ? addr : region->start;
+        uint32_t stop = (end < region->end) ? end : region->end;
+
+        if ((start > region->start) && (stop < region->end))
+        {
+            // 从区域中间解除，剩余的尾部拆成新区域。新区域位于解除范围之后，遍历时会被跳过
+            mem_region_t *tail = region_alloc();
+            if (tail == (mem_region_t *)0)
+            {
+                err = -1;
+                break;
+            }
+
+            kernel_memcpy(tail, region, sizeof(mem_region_t));
+            tail->start = stop;
+            if (tail->file)
+                file_inc_ref(tail->file);
+            list_insert_last(&task->region_list, &tail->node);
+
+            region_unmap_pages(region, page_dir, start, stop);
+            region->end = start;
         }
         else
         {
-            uint32_t curr_size = MEM_PAGE_SIZE - start_offset;
-            start += curr_size;
-            incr -= curr_size;
+            region_unmap_pages(region, page_dir, start, stop);
+            if (start > region->start)
+                region->end = start;
+            else if (stop < region->end)
+                region->start = stop;
+            else
+            {
+                list_remove(&task->region_list, &region->node);
+                region_free(region);
+            }
         }
     }
 
-    if (incr)
+    ring_resume(task);
+    return err;
+}
+
+/**
+ * @brief 对一段地址的使用方式给出建议
+ * MADV_DONTNEED释放范围内的物理页，区域保留，再次访问时重新分配清零的页或从文件装入
+ */
+int sys_madvise(uint32_t addr, uint32_t length, int advice)
+{
+    if ((addr & (MEM_PAGE_SIZE - 1)) || (addr < MEMORY_TASK_BASE))
+        return -1;
+
+    uint32_t end = up2(addr + length, MEM_PAGE_SIZE);
+    if (end < addr)
+        return -1;
+
+    switch (advice)
     {
-        uint32_t curr_size = end - start;
-        int err = memory_alloc_page_for(start, curr_size, PTE_P | PTE_U | PTE_W);
-        if (err < 0)
+    case MADV_NORMAL:
+        return 0;
+    case MADV_WILLNEED:
+        return memory_fault_in(addr, end - addr);
+    case MADV_DONTNEED:
+        break;
+    default:
+        return -1;
+    }
+
+    task_t *task = task_current();
+    pde_t *page_dir = (pde_t *)task->cr3;
+
+    ring_pause(task);
+
+    list_node_t *node = list_first(&task->region_list);
+    while (node)
+    {
+        mem_region_t *region = list_node_parent(node, mem_region_t, node);
+        node = list_node_next(node);
+
+        // 共享映射(含共享内存段)的页与其它进程共用，释放后本进程会换成新页，不再共享，跳过
+        if ((region->flags & MEM_REGION_SHARED) || (region->end <= addr) || (region->start >= end))
+            continue;
+
+        uint32_t start = (addr > region->start) ? addr : region->start;
+        uint32_t stop = (end < region->end) ? end : region->end;
+        region_unmap_pages(region, page_dir, start, stop);
+    }
+
+    ring_resume(task);
+    return 0;
+}
+
+/**
+ * @brief 将一组已分配的物理页映射到当前进程，各页的引用计数加1
+ * @return 映射的起始地址，失败返回0
+ */
+uint32_t memory_map_pages(uint32_t vaddr, uint32_t *pages, int page_count, uint32_t perm, int flags)
+{
+    task_t *task = task_current();
+    pde_t *page_dir = (pde_t *)task->cr3;
+
+    vaddr = mmap_get_area(&task->region_list, vaddr, page_count * MEM_PAGE_SIZE);
+    if (vaddr == 0)
+        return 0;
+
+    mem_region_t *region = memory_add_region(&task->region_list, vaddr,
+                                             vaddr + page_count * MEM_PAGE_SIZE, perm);
+    if (region == (mem_region_t *)0)
+        return 0;
+    region->flags = flags;
+
+    for (int i = 0; i < page_count; i++)
+    {
+        if (memory_create_map(page_dir, vaddr + i * MEM_PAGE_SIZE, pages[i], 1, perm) < 0)
         {
-            log_printf("sbrk: alloc mem failed.");
-            return (char *)-1;
+            region_unmap_pages(region, page_dir, vaddr, vaddr + i * MEM_PAGE_SIZE);
+            list_remove(&task->region_list, &region->node);
+            region_free(region);
+            return 0;
+        }
+
+        addr_ref_page(page_zone(pages[i]), pages[i]);
+    }
+
+    return vaddr;
+}
+
+/**
+ * @brief 解除当前进程中以vaddr开始、带有指定标志的整个区域
+ */
+int memory_unmap_region(uint32_t vaddr, int flags)
+{
+    task_t *task = task_current();
+    pde_t *page_dir = (pde_t *)task->cr3;
+
+    mem_region_t *region = memory_find_region(&task->region_list, vaddr);
+    if ((region == (mem_region_t *)0) || (region->start != vaddr) || !(region->flags & flags))
+        return -1;
+
+    ring_pause(task);
+    region_unmap_pages(region, page_dir, region->start, region->end);
+    list_remove(&task->region_list, &region->node);
+    region_free(region);
+    ring_resume(task);
+    return 0;
+}
+
+/**
+ * @brief 统计地址空间中已映射的用户页数
+ */
+uint32_t memory_count_rss(uint32_t page_dir)
+{
+    uint32_t count = 0;
+    pde_t *pde = (pde_t *)page_dir + pde_index(MEMORY_TASK_BASE);
+
+    for (int i = pde_index(MEMORY_TASK_BASE); i < PDE_CNT; i++, pde++)
+    {
+        if (!pde->present)
+            continue;
+
+        pte_t *pte = (pte_t *)pde_paddr(pde);
+        for (int j = 0; j < PTE_CNT; j++, pte++)
+        {
+            if (pte->present)
+                count++;
         }
     }
 
-    log_printf("sbrk(%d): end=0x%x", pre_incr, end);
-    task->heap_end = end;
-    return (char *)pre_heap_end;
-}
\ No newline at end of file
+    return count;
+}
+
+void memory_get_stat(mem_stat_t *stat)
+{
+    irq_state_t state = irq_enter_protection();
+    irq_state_t stat_state = spin_lock_irqsave(&paddr_alloc.lock);
+    *stat = mem_stat;
+    spin_unlock_irqrestore(&paddr_alloc.lock, stat_state);
+    stat->high_total = highmem_alloc.size / MEM_PAGE_SIZE;
+    stat->high_free = highmem_alloc.free_count;
+    stat->total = paddr_alloc.size / MEM_PAGE_SIZE + stat->high_total;
+    stat->free = paddr_alloc.free_count + stat->high_free;
+    stat->zero_pool = list_count(&zero_list);
+    irq_leave_protection(state);
+
+    stat->slab = kmem_page_count();
+}
+
+int sys_meminfo(mem_stat_t *stat)
+{
+    if (memory_fault_in((uint32_t)stat, sizeof(mem_stat_t)) < 0)
+        return -1;
+
+    memory_get_stat(stat);
+    return 0;
+}
+
+#if OS_BENCH
+#include "tools/bitmap.h"
+
+#define BENCH_PAGE_NR 4096
+
+static uint32_t bench_pages[BENCH_PAGE_NR];
+static uint8_t bench_bits[BENCH_PAGE_NR / 8];
+static mem_page_t bench_descs[BENCH_PAGE_NR];
+static addr_alloc_t bench_alloc;
+
+static int bitmap_max_free(bitmap_t *bitmap)
+{
+    int max = 0, curr = 0;
+    for (int i = 0; i < bitmap->bit_count; i++)
+    {
+        curr = bitmap_get_bit(bitmap, i) ? 0 : curr + 1;
+        if (curr > max)
+            max = curr;
+    }
+
+    return max;
+}
+
+static int buddy_max_free(addr_alloc_t *alloc)
+{
+    for (int order = MEM_BUDDY_ORDER_NR - 1; order >= 0; order--)
+    {
+        if (!list_is_empty(&alloc->free_list[order]))
+            return 1 << order;
+    }
+
+    return 0;
+}
+
+/**
+ * 对比原位图分配与伙伴系统的单页分配/释放开销及碎片情况
+ * 先分配BENCH_PAGE_NR个页，释放其中一半(交错)，再全部释放
+ * 伙伴系统使用同样大小的私有分配器，只操作页描述表，不访问页本身
+ */
+void memory_bench(void)
+{
+    bitmap_t bitmap;
+    bitmap_init(&bitmap, bench_bits, BENCH_PAGE_NR, 0);
+
+    uint32_t start = read_tsc();
+    for (int i = 0; i < BENCH_PAGE_NR; i++)
+        bench_pages[i] = bitmap_alloc_nbits(&bitmap, 0, 1);
+    uint32_t alloc_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (int i = 0; i < BENCH_PAGE_NR; i += 2)
+        bitmap_set_bit(&bitmap, bench_pages[i], 1, 0);
+    int max_free = bitmap_max_free(&bitmap);
+    for (int i = 1; i < BENCH_PAGE_NR; i += 2)
+        bitmap_set_bit(&bitmap, bench_pages[i], 1, 0);
+    uint32_t free_cycles = read_tsc() - start;
+
+    log_printf("bench bitmap: alloc %d cycles/page, free %d cycles/page, max free run after half free: %d",
+               alloc_cycles / BENCH_PAGE_NR, free_cycles / BENCH_PAGE_NR, max_free);
+
+    addr_alloc_init(&bench_alloc, bench_descs, MEM_EXT_START, BENCH_PAGE_NR * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+    start = read_tsc();
+    for (int i = 0; i < BENCH_PAGE_NR; i++)
+        bench_pages[i] = addr_alloc_page(&bench_alloc, 1);
+    alloc_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (int i = 0; i < BENCH_PAGE_NR; i += 2)
+        addr_free_page(&bench_alloc, bench_pages[i], 1);
+    max_free = buddy_max_free(&bench_alloc);
+    for (int i = 1; i < BENCH_PAGE_NR; i += 2)
+        addr_free_page(&bench_alloc, bench_pages[i], 1);
+    free_cycles = read_tsc() - start;
+
+    log_printf("bench buddy: alloc %d cycles/page, free %d cycles/page, max free block after half free: %d",
+               alloc_cycles / BENCH_PAGE_NR, free_cycles / BENCH_PAGE_NR, max_free);
+    ASSERT(bench_alloc.free_count == BENCH_PAGE_NR);
+}
+#endif
@@ -4,6 +4,10 @@
 #include "tools/log.h"
 #include "fs/fs.h"
 #include "dev/tty.h"
+#include "ipc/shm.h"
+#include "ipc/futex.h"
+#include "fs/ring.h"
+#include "cpu/irq.h"
 
 typedef int (*syscall_handler_t)(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3);
 
@@ -18,6 +22,8 @@ static const syscall_handler_t sys_table[] = {
     [SYS_fork] = (syscall_handler_t)sys_fork,
     [SYS_execve] = (syscall_handler_t)sys_execve,
     [SYS_yield] = (syscall_handler_t)sys_yield,
+    [SYS_spawn] = (syscall_handler_t)sys_spawn,
+    [SYS_vfork] = (syscall_handler_t)sys_vfork,
     [SYS_exit] = (syscall_handler_t)sys_exit,
     [SYS_wait] = (syscall_handler_t)sys_wait,
     [SYS_printmsg] = (syscall_handler_t)sys_print_msg,
@@ -38,10 +44,43 @@ static const syscall_handler_t sys_table[] = {
     [SYS_readdir] = (syscall_handler_t)sys_readdir,
     [SYS_closedir] = (syscall_handler_t)sys_closedir,
     [SYS_unlink] = (syscall_handler_t)sys_unlink,
+    [SYS_mmap] = (syscall_handler_t)sys_mmap,
+    [SYS_munmap] = (syscall_handler_t)sys_munmap,
+    [SYS_shmget] = (syscall_handler_t)sys_shmget,
+    [SYS_shmat] = (syscall_handler_t)sys_shmat,
+    [SYS_shmdt] = (syscall_handler_t)sys_shmdt,
+    [SYS_shmctl] = (syscall_handler_t)sys_shmctl,
+    [SYS_madvise] = (syscall_handler_t)sys_madvise,
+    [SYS_meminfo] = (syscall_handler_t)sys_meminfo,
+    [SYS_taskinfo] = (syscall_handler_t)sys_taskinfo,
+    [SYS_setpriority] = (syscall_handler_t)sys_setpriority,
+    [SYS_getpriority] = (syscall_handler_t)sys_getpriority,
+    [SYS_ring_enter] = (syscall_handler_t)sys_ring_enter,
+    [SYS_futex_wait] = (syscall_handler_t)sys_futex_wait,
+    [SYS_futex_wake] = (syscall_handler_t)sys_futex_wake,
+    [SYS_ring_setup] = (syscall_handler_t)sys_ring_setup,
+    [SYS_ring_release] = (syscall_handler_t)sys_ring_release,
+};
+
+// 只访问当前进程自己的数据，不需要内核锁，需要时在内部加锁
+static const uint8_t sys_unlocked[] = {
+    [SYS_getpid] = 1,
+    [SYS_yield] = 1,
+    [SYS_sbrk] = 1,
 };
 
 void do_handler_syscall(syscall_frame_t *frame)
 {
+    uint32_t id = frame->func_id;
+    if ((id < sizeof(sys_unlocked) / sizeof(sys_unlocked[0])) && sys_unlocked[id])
+    {
+        frame->eax = sys_table[id](frame->arg0, frame->arg1, frame->arg2, frame->arg3);
+        return;
+    }
+
+    // 系统调用开着中断执行，但同一时刻只有一个CPU在内核中
+    irq_lock_kernel();
+
     if (frame->func_id < sizeof(sys_table) / sizeof(sys_table[0]))
     {
         syscall_handler_t handler = sys_table[frame->func_id];
@@ -49,6 +88,7 @@ void do_handler_syscall(syscall_frame_t *frame)
         {
             int ret = handler(frame->arg0, frame->arg1, frame->arg2, frame->arg3);
             frame->eax = ret;
+            irq_unlock_kernel();
             return;
         }
     }
@@ -56,4 +96,5 @@ void do_handler_syscall(syscall_frame_t *frame)
     task_t *task = task_current();
     log_printf("task: %s, Unknown syscall: %d", task->name, frame->func_id);
     frame->eax = -1;
+    irq_unlock_kernel();
 }
\ No newline at end of file
@@ -11,17 +11,34 @@
 #include "core/syscall.h"
 #include "cpu/mmu.h"
 #include "fs/fs.h"
+#include "fs/ring.h"
+#include "core/kmem.h"
+#include "core/image.h"
+#include "dev/time.h"
+#include "cpu/smp.h"
 
-static uint32_t idle_task_stack[IDLE_TASK_STACK_SIZE];
+static uint32_t idle_task_stack[OS_CPU_MAX][IDLE_TASK_STACK_SIZE];
 static task_manager_t task_manager;
-static task_t task_table[TASK_NR];
-static mutex_t task_table_mutex;
+static kmem_cache_t task_cache;
+
+/**
+ * 当前CPU的运行队列，调用者需关中断，避免中途被切换到其它CPU
+ */
+static task_rq_t *task_this_rq(void)
+{
+    return task_manager.rq + cpu_id();
+}
+
+static int task_is_idle(task_t *task)
+{
+    return task->flags & TASK_FLAGS_IDLE;
+}
 
 file_t *task_file(int fd)
 {
     if (fd >= 0 && fd < TASK_OFILE_NR)
     {
-        file_t *file = task_current()->file_table[fd];
+        file_t *file = task_current_proc()->file_table[fd];
         return file;
     }
 
@@ -30,7 +47,7 @@ file_t *task_file(int fd)
 
 int task_alloc_fd(file_t *file)
 {
-    task_t *task = task_current();
+    task_t *task = task_current_proc();
     for (int i = 0; i < TASK_OFILE_NR; i++)
     {
         file_t *p = task->file_table[i];
@@ -47,90 +64,76 @@ int task_alloc_fd(file_t *file)
 void task_remove_fd(int fd)
 {
     if (fd >= 0 && (fd < TASK_OFILE_NR))
-        task_current()->file_table[fd] = (file_t *)0;
+        task_current_proc()->file_table[fd] = (file_t *)0;
 }
 
-static int tss_init(task_t *task, int flag, uint32_t entry, uint32_t esp)
+/**
+ * @brief 构造任务首次运行时的现场：simple_switch从栈上恢复寄存器后返回到task_entry，
+ * 再由task_entry恢复段寄存器和通用寄存器，iret进入任务入口
+ */
+static int task_stack_init(task_t *task, int flag, uint32_t entry, uint32_t esp)
 {
-    int tss_sel = gdt_alloc_desc();
-    if (tss_sel < 0)
-    {
-        log_printf("alloc tss failed.\n");
-        return -1;
-    }
-
-    segment_desc_set(tss_sel, (uint32_t)&task->tss, sizeof(tss_t),
-                     SEG_P_PRESENT | SEG_DPL0 | SEG_TYPE_TSS);
-
-    kernel_memset(&task->tss, 0, sizeof(tss_t));
+    task_frame_t *frame;
+    uint32_t data_sel;
 
-    uint32_t kernel_stack = memory_alloc_page();
-    if (kernel_stack == 0)
-        goto tss_init_failed;
-
-    int code_sel, data_sel;
     if (flag & TASK_FLAGS_SYSTEM)
     {
-        code_sel = KERNEL_SELECTOR_CS;
+        // 内核线程一直在内核态运行，直接使用给定的栈，iret时不换栈
+        frame = (task_frame_t *)(esp - offset_in_parent(task_frame_t, esp));
+        kernel_memset(frame, 0, offset_in_parent(task_frame_t, esp));
+        frame->cs = KERNEL_SELECTOR_CS;
         data_sel = KERNEL_SELECTOR_DS;
+
+        // 内核线程没有自己的地址空间，运行时借用上一个任务的页目录
+        task->esp0 = 0;
+        task->cr3 = memory_kernel_page_dir();
     }
     else
     {
-        code_sel = task_manager.app_code_sel | SEG_RPL3;
-        data_sel = task_manager.app_data_sel | SEG_RPL3;
-    }
+        uint32_t kernel_stack = memory_alloc_page();
+        if (kernel_stack == 0)
+            return -1;
 
-    task->tss.eip = entry;
-    task->tss.esp = esp;
-    task->tss.esp0 = kernel_stack + MEM_PAGE_SIZE;
-    task->tss.ss0 = KERNEL_SELECTOR_DS;
-    task->tss.ss = data_sel;
-    task->tss.es = task->tss.ds = task->tss.fs = task->tss.gs = data_sel;
-    task->tss.cs = code_sel;
-    task->tss.eflags = EFLAGS_IF | EFLAGS_DEFAULT;
-    uint32_t page_dir = memory_create_uvm();
-    if (page_dir == 0)
-    {
-        gdt_free_sel(tss_sel);
-        goto tss_init_failed;
-    }
-    task->tss.cr3 = page_dir;
+        uint32_t page_dir = memory_create_uvm();
+        if (page_dir == 0)
+        {
+            memory_free_page(kernel_stack);
+            return -1;
+        }
 
-    task->tss_sel = tss_sel;
-    return 0;
+        task->esp0 = kernel_stack + MEM_PAGE_SIZE;
+        task->cr3 = page_dir;
+        memory_vdata_set_pid(page_dir, task->pid);
+
+        frame = (task_frame_t *)(task->esp0 - sizeof(task_frame_t));
+        kernel_memset(frame, 0, sizeof(task_frame_t));
+        frame->cs = APP_SELECTOR_CS | SEG_RPL3;
+        data_sel = APP_SELECTOR_DS | SEG_RPL3;
+        frame->esp = esp;
+        frame->ss = data_sel;
+    }
 
-tss_init_failed:
-    gdt_free_sel(tss_sel);
-    if (kernel_stack)
-        memory_free_page(kernel_stack);
+    frame->ret = (uint32_t)task_entry;
+    frame->gs = frame->fs = frame->es = frame->ds = data_sel;
+    frame->eip = entry;
+    frame->eflags = EFLAGS_IF | EFLAGS_DEFAULT;
 
-    return -1;
+    task->stack = (uint32_t *)frame;
+    return 0;
 }
 
 static task_t *alloc_task(void)
 {
-    task_t *task = (task_t *)0;
-
-    mutex_lock(&task_table_mutex);
-    for (int i = 0; i < TASK_NR; i++)
-    {
-        task_t *curr = task_table + i;
-        if (curr->name[0] == '\0')
-        {
-            task = curr;
-            break;
-        }
-    }
-    mutex_unlock(&task_table_mutex);
+    task_t *task = (task_t *)kmem_cache_alloc(&task_cache);
+    if (task)
+        kernel_memset(task, 0, sizeof(task_t));
 
     return task;
 }
 
 static void free_task(task_t *task)
 {
-    mutex_lock(&task_table_mutex);
-    task->name[0] = '\0';
-    mutex_unlock(&task_table_mutex);
+    kmem_cache_free(&task_cache, task);
 }
 
 /**
@@ -140,15 +143,16 @@ static void free_task(task_t *task)
  */
 void sys_msleep(uint32_t ms)
 {
-    // 至少延时1个tick
-    if (ms < OS_TICK_MS)
-        ms = OS_TICK_MS;
+    // 至少延时1ms，空闲时按到期时间单次定时，忙时到下个tick才唤醒
+    if (ms == 0)
+        ms = 1;
 
     irq_state_t state = irq_enter_protection();
 
     // 从就绪队列移除，加入睡眠队列
-    task_set_block(task_manager.curr_task);
-    task_set_sleep(task_manager.curr_task, (ms + (OS_TICK_MS - 1)) / OS_TICK_MS);
+    task_t *curr_task = task_current();
+    task_set_block(curr_task);
+    task_set_sleep(curr_task, ms);
 
     // 进行一次调度
     task_dispatch();
@@ -156,71 +160,232 @@ void sys_msleep(uint32_t ms)
     irq_leave_protection(state);
 }
 
-void task_set_ready(task_t *task)
+/**
+ * 任务加入就绪队列后，能抢占所在CPU上运行的任务时通知该CPU重新调度，
+ * 否则唤醒一个空闲的CPU来取走
+ */
+static void task_kick(task_t *task)
 {
-    if (task == &task_manager.idle_task)
+    if (smp_cpu_count() == 1)
+        return;
+
+    task_t *curr = task_manager.rq[task->cpu].curr_task;
+    if (curr == task)
+        return;
+
+    if (task_is_idle(curr) || (task->prio < curr->prio))
+    {
+        smp_send_resched(task->cpu);
         return;
+    }
+
+    int self = cpu_id();
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        task_rq_t *rq = task_manager.rq + i;
+        if ((i != task->cpu) && task_is_idle(rq->curr_task))
+        {
+            // 当前CPU空闲时，回到空闲任务后自己会取
+            if (i != self)
+                smp_send_resched(i);
+            return;
+        }
+    }
+}
 
-    list_insert_last(&task_manager.ready_list, &task->run_node);
+static void rq_insert(task_t *task)
+{
+    task_rq_t *rq = task_manager.rq + task->cpu;
+    list_insert_last(&rq->ready_list[task->prio], &task->run_node);
+    rq->ready_bitmap |= 1 << task->prio;
+    rq->ready_count++;
     task->state = TASK_READY;
 }
 
+void task_set_ready(task_t *task)
+{
+    if (task_is_idle(task))
+        return;
+
+    rq_insert(task);
+    task_kick(task);
+}
+
+/**
+ * 时间片随优先级变化，优先级越高越长，最低的只有1个tick
+ */
+static int prio_time_slice(int prio)
+{
+    int ticks = TASK_TIME_SLICE_DEFAULT * (TASK_PRIO_NR - prio) / (TASK_PRIO_NR - TASK_PRIO_DEFAULT);
+    return ticks > 0 ? ticks : 1;
+}
+
 int task_init(task_t *task, const char *name, int flag,
               uint32_t entry, uint32_t esp)
 {
     ASSERT(task != (task_t *)0);
 
-    tss_init(task, flag, entry, esp);
-
     kernel_strncpy(task->name, name, TASK_NAME_SIZE);
     task->state = TASK_CRATED;
     task->pid = (uint32_t)task;
-    task->sleep_ticks = 0;
+    task->flags = flag;
+    task->sleep_ms = 0;
     task->parent = (task_t *)0;
     task->heap_start = 0;
     task->heap_end = 0;
-    task->time_ticks = TASK_TIME_SLICE_DEFAULT;
+    list_init(&task->region_list);
+    task->prio = TASK_PRIO_DEFAULT;
+    task->time_ticks = prio_time_slice(task->prio);
     task->slice_ticks = task->time_ticks;
     task->status = 0;
+    task->page_fault = 0;
+    task->cow_copy = 0;
+    task->esp0 = task->cr3 = 0;
+    task->cpu = cpu_id();
+    task->migrated = 0;
+    task->lock_depth = 1; // 首次切换时持有的内核锁在task_entry中释放
+    task->owner = (task_t *)0;
+    task->ring = (struct _ring_worker_t *)0;
     list_node_init(&task->all_node);
     list_node_init(&task->run_node);
     list_node_init(&task->wait_node);
 
     kernel_memset(&task->file_table, 0, sizeof(task->file_table));
 
-    irq_state_t state = irq_enter_protection();
+    irq_state_t state = spin_lock_irqsave(&task_manager.list_lock);
     list_insert_last(&task_manager.task_list, &task->all_node);
-    irq_leave_protection(state);
+    spin_unlock_irqrestore(&task_manager.list_lock, state);
+
+    // 失败时已在任务表中，由调用者task_uninit
+    if (task_stack_init(task, flag, entry, esp) < 0)
+    {
+        log_printf("task: no memory for %s", name);
+        return -1;
+    }
 
     return 0;
 }
 
+/**
+ * 队列中任务最少的CPU，相同时优先选当前CPU
+ */
+static int task_idlest_cpu(void)
+{
+    int best = cpu_id();
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        if (task_manager.rq[i].ready_count < task_manager.rq[best].ready_count)
+            best = i;
+    }
+
+    return best;
+}
+
 void task_start(task_t *task)
 {
     irq_state_t state = irq_enter_protection();
+    task->cpu = task_idlest_cpu();
     task_set_ready(task);
     irq_leave_protection(state);
 }
 
 void task_uninit(task_t *task)
 {
-    if (task->tss_sel)
-        gdt_free_sel(task->tss_sel);
+    irq_state_t state = spin_lock_irqsave(&task_manager.list_lock);
+    list_remove(&task_manager.task_list, &task->all_node);
+    spin_unlock_irqrestore(&task_manager.list_lock, state);
 
-    if (task->tss.esp0)
-        memory_free_page(task->tss.esp0 - MEM_PAGE_SIZE);
+    if (task->esp0)
+        memory_free_page(task->esp0 - MEM_PAGE_SIZE);
 
-    if (task->tss.cr3)
-        memory_destroy_uvm(task->tss.cr3);
+    // vfork的子进程退出时换用了内核的页目录，不属于该进程
+    if (task->cr3 && (task->cr3 != memory_kernel_page_dir()) && !(task->flags & TASK_FLAGS_SYSTEM))
+        memory_destroy_uvm(task->cr3);
 
+    memory_free_regions(&task->region_list);
     kernel_memset(task, 0, sizeof(task_t));
 }
 
-void simple_switch(uint32_t **from, uint32_t *to);
+/**
+ * 本CPU已不再使用推迟释放的页目录，其它CPU也都不再使用时释放
+ */
+static void rq_put_dead_page_dir(task_rq_t *rq)
+{
+    uint32_t page_dir = rq->dead_cr3;
+    rq->dead_cr3 = 0;
+
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        if (task_manager.rq[i].dead_cr3 == page_dir)
+            return;
+    }
+
+    memory_free_page_dir(page_dir);
+}
+
+/**
+ * @brief 进程的页目录即将释放时调用，其它CPU上借用它的内核线程切换走之后才能释放
+ * @return 1表示仍被借用，由这些CPU在切换时释放
+ */
+int task_defer_page_dir(uint32_t page_dir)
+{
+    int deferred = 0;
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        task_rq_t *rq = task_manager.rq + i;
+        task_t *curr = rq->curr_task;
+        if ((i == cpu_id()) || (curr == (task_t *)0))
+            continue;
+
+        if ((curr->flags & TASK_FLAGS_SYSTEM) && !curr->owner && (curr->cr3 == page_dir))
+        {
+            // CPU上只加载着当前任务的页目录，之前推迟的另一个已不再使用，先释放再记录
+            if (rq->dead_cr3 && (rq->dead_cr3 != page_dir))
+                rq_put_dead_page_dir(rq);
+            rq->dead_cr3 = page_dir;
+            deferred = 1;
+        }
+    }
+
+    return deferred;
+}
+
+/**
+ * @brief 在内核栈上保存/恢复现场完成切换，只需更新当前CPU的TSS中的esp0
+ */
 void task_switch_from_to(task_t *from, task_t *to)
 {
-    switch_to_tss(to->tss_sel);
-    // simple_switch(&from->stack, to->stack);
+    task_rq_t *rq = task_this_rq();
+    int flush = to->migrated;
+
+    if (to->owner)
+    {
+        // 代进程执行的内核线程使用进程的页目录，进程可能在其它CPU上改过页表
+        to->cr3 = to->owner->cr3;
+        flush = 1;
+    }
+    else if (to->flags & TASK_FLAGS_SYSTEM)
+    {
+        // 内核线程只访问内核空间，沿用当前的页目录，不清空TLB
+        // 页目录所属的进程已在其它CPU上被回收时改用内核的页目录
+        to->cr3 = (read_cr3() == rq->dead_cr3) ? memory_kernel_page_dir() : read_cr3();
+    }
+    else
+    {
+        tss_set_esp0(to->esp0);
+        memory_vdata_set_pid(to->cr3, to->pid);
+    }
+
+    // 从其它CPU取来的进程在那里修改过页表，本CPU的TLB中可能还有旧的表项
+    if ((to->cr3 != read_cr3()) || flush)
+        mmu_set_page_dir(to->cr3);
+    to->migrated = 0;
+
+    if (rq->dead_cr3 && (rq->dead_cr3 != read_cr3()))
+        rq_put_dead_page_dir(rq);
+
+    from->lock_depth = irq_swap_lock_depth(to->lock_depth);
+    simple_switch(&from->stack, to->stack);
 }
 
 void task_first_init(void)
@@ -235,12 +400,18 @@ void task_first_init(void)
     uint32_t first_start = (uint32_t)first_task_entry;
 
     task_init(&task_manager.first_task, "first task", 0, first_start, (uint32_t)first_task_entry + alloc_size);
-    task_manager.first_task.heap_start = (uint32_t)e_first_task;
-    task_manager.first_task.heap_end = (uint32_t)e_first_task;
-    write_tr(task_manager.first_task.tss_sel);
-    task_manager.curr_task = &task_manager.first_task;
 
-    mmu_set_page_dir(task_manager.first_task.tss.cr3);
+    // 代码和栈共用直接分配的一段页，堆放在其上方，与其它进程一样按需分配
+    uint32_t heap_start = first_start + alloc_size;
+    mem_region_t *heap = memory_add_region(&task_manager.first_task.region_list, heap_start, heap_start,
+                                           PTE_P | PTE_U | PTE_W);
+    ASSERT(heap != (mem_region_t *)0);
+    heap->flags = MEM_REGION_HEAP;
+    task_manager.first_task.heap_start = heap_start;
+    task_manager.first_task.heap_end = heap_start;
+    task_this_rq()->curr_task = &task_manager.first_task;
+
+    mmu_set_page_dir(task_manager.first_task.cr3);
 
     memory_alloc_page_for(first_start, alloc_size, PTE_P | PTE_W | PTE_U);
     kernel_memcpy((void *)first_start, s_first_task, copy_size);
@@ -255,69 +426,274 @@ task_t *task_first_task(void)
 static void idle_task(void)
 {
     for (;;)
-        hlt();
+    {
+        // 空闲时预先清零物理页，无事可做时才停机
+        if (!memory_zero_pool_refill())
+            time_idle();
+    }
 }
 
 void task_manager_init(void)
 {
-    kernel_memset(task_table, 0, sizeof(task_table));
-    mutex_init(&task_table_mutex);
+    kmem_cache_init(&task_cache, "task", sizeof(task_t), 0);
 
-    int sel = gdt_alloc_desc();
-    segment_desc_set(sel, 0x00000000, 0xFFFFFFFF,
-                     SEG_P_PRESENT | SEG_DPL3 |
-                         SEG_S_NORMAL | SEG_TYPE_DATA | SEG_TYPE_RW | SEG_D);
-    task_manager.app_data_sel = sel;
-
-    sel = gdt_alloc_desc();
-    segment_desc_set(sel, 0x00000000, 0xFFFFFFFF,
-                     SEG_P_PRESENT | SEG_DPL3 |
-                         SEG_S_NORMAL | SEG_TYPE_CODE | SEG_TYPE_RW | SEG_D);
-    task_manager.app_code_sel = sel;
-
-    list_init(&task_manager.ready_list);
     list_init(&task_manager.task_list);
+    spin_init(&task_manager.list_lock);
     list_init(&task_manager.sleep_list);
-    task_manager.curr_task = (task_t *)0;
+    task_idle_init(0);
+}
 
-    task_init(&task_manager.idle_task, "idle_task",
-              TASK_FLAGS_SYSTEM,
+/**
+ * @brief 初始化CPU的运行队列及其空闲任务
+ */
+void task_idle_init(int cpu)
+{
+    task_rq_t *rq = task_manager.rq + cpu;
+    for (int i = 0; i < TASK_PRIO_NR; i++)
+        list_init(&rq->ready_list[i]);
+    rq->ready_bitmap = 0;
+    rq->ready_count = 0;
+    rq->dead_cr3 = 0;
+
+    task_init(&rq->idle_task, "idle_task",
+              TASK_FLAGS_SYSTEM | TASK_FLAGS_IDLE,
               (uint32_t)idle_task,
-              (uint32_t)(&idle_task_stack[IDLE_TASK_STACK_SIZE]));
-    task_start(&task_manager.idle_task);
+              (uint32_t)(&idle_task_stack[cpu][IDLE_TASK_STACK_SIZE]));
+    rq->idle_task.cpu = cpu;
+    rq->curr_task = &rq->idle_task;
+}
+
+/**
+ * @brief AP启动后切换到自己的空闲任务，启动时的栈不再使用
+ */
+void task_idle_start(void)
+{
+    uint32_t *boot_stack;
+
+    // 内核锁在task_entry中释放
+    irq_enter_protection();
+
+    task_rq_t *rq = task_this_rq();
+    rq->curr_task = &rq->idle_task;
+    rq->idle_task.state = TASK_RUNNING;
+    simple_switch(&boot_stack, rq->idle_task.stack);
 }
 
 void task_set_block(task_t *task)
 {
-    if (task == &task_manager.idle_task)
+    if (task_is_idle(task))
         return;
 
-    list_remove(&task_manager.ready_list, &task->run_node);
+    task_rq_t *rq = task_manager.rq + task->cpu;
+    list_t *list = &rq->ready_list[task->prio];
+    list_remove(list, &task->run_node);
+    rq->ready_count--;
+    if (list_is_empty(list))
+        rq->ready_bitmap &= ~(1 << task->prio);
+}
+
+/**
+ * 队列中优先级最高的、未在运行的任务
+ */
+static task_t *rq_first_waiting(task_rq_t *rq)
+{
+    uint32_t bitmap = rq->ready_bitmap;
+    while (bitmap)
+    {
+        int prio = __builtin_ctz(bitmap);
+        list_node_t *node = list_first(&rq->ready_list[prio]);
+        while (node)
+        {
+            task_t *task = list_node_parent(node, task_t, run_node);
+            if ((task != rq->curr_task) && (task->state == TASK_READY))
+                return task;
+
+            node = list_node_next(node);
+        }
+
+        bitmap &= bitmap - 1;
+    }
+
+    return (task_t *)0;
 }
 
+/**
+ * 本CPU无事可做时，从其它CPU的队列中找一个等待运行的任务
+ * 取优先级最高的，相同时取自负载最重的CPU
+ */
+static task_t *task_find_steal(void)
+{
+    task_t *best = (task_t *)0;
+    int best_load = 0;
+
+    int self = cpu_id();
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        task_rq_t *rq = task_manager.rq + i;
+        if (i == self)
+            continue;
+
+        task_t *task = rq_first_waiting(rq);
+        if (task == (task_t *)0)
+            continue;
+
+        if ((best == (task_t *)0) || (task->prio < best->prio) ||
+            ((task->prio == best->prio) && (rq->ready_count > best_load)))
+        {
+            best = task;
+            best_load = rq->ready_count;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * 取优先级最高的非空队列的第一个进程，查找时间与进程数无关
+ * 本CPU的队列为空时从其它CPU取一个过来
+ */
 task_t *task_next_run(void)
 {
-    if (list_count(&task_manager.ready_list) == 0)
-        return &task_manager.idle_task;
+    task_rq_t *rq = task_this_rq();
+    if (rq->ready_bitmap == 0)
+    {
+        task_t *task = task_find_steal();
+        if (task == (task_t *)0)
+            return &rq->idle_task;
+
+        task_set_block(task);
+        task->cpu = cpu_id();
+        task->migrated = 1;
+        rq_insert(task);
+    }
 
-    list_node_t *task_node = list_first(&task_manager.ready_list);
+    int prio = __builtin_ctz(rq->ready_bitmap);
+    list_node_t *task_node = list_first(&rq->ready_list[prio]);
 
     return list_node_parent(task_node, task_t, run_node);
 }
 
+/**
+ * @brief 修改进程的优先级，在就绪队列中的进程移到新队列的末尾
+ * 唤醒或提高优先级后，若高于当前进程，下次调度时立即切换
+ */
+void task_set_priority(task_t *task, int prio)
+{
+    irq_state_t state = irq_enter_protection();
+
+    // 在其它CPU上运行的进程同样留在其队列中
+    int running = (task == task_manager.rq[task->cpu].curr_task);
+    int queued = running || (task->state == TASK_READY);
+    if (queued)
+        task_set_block(task);
+
+    task->prio = prio;
+    task->time_ticks = prio_time_slice(prio);
+    if (task->slice_ticks > task->time_ticks)
+        task->slice_ticks = task->time_ticks;
+
+    if (queued)
+    {
+        task_set_ready(task);
+        if (running)
+            task->state = TASK_RUNNING;
+    }
+
+    irq_leave_protection(state);
+}
+
+static task_t *find_task(int pid)
+{
+    if (pid == 0)
+        return task_current();
+
+    task_t *found = (task_t *)0;
+    irq_state_t state = spin_lock_irqsave(&task_manager.list_lock);
+
+    list_node_t *node = list_first(&task_manager.task_list);
+    while (node)
+    {
+        task_t *task = list_node_parent(node, task_t, all_node);
+        if (task->pid == pid)
+        {
+            found = task;
+            break;
+        }
+
+        node = list_node_next(node);
+    }
+
+    spin_unlock_irqrestore(&task_manager.list_lock, state);
+    return found;
+}
+
+/**
+ * @brief 设置进程的nice值，pid为0表示当前进程
+ */
+int sys_setpriority(int pid, int nice)
+{
+    if (nice < TASK_NICE_MIN)
+        nice = TASK_NICE_MIN;
+    else if (nice > TASK_NICE_MAX)
+        nice = TASK_NICE_MAX;
+
+    irq_state_t state = irq_enter_protection();
+
+    task_t *task = find_task(pid);
+    if ((task == (task_t *)0) || (task->flags & TASK_FLAGS_SYSTEM))
+    {
+        irq_leave_protection(state);
+        return -1;
+    }
+
+    task_set_priority(task, TASK_PRIO_DEFAULT + nice);
+    task_dispatch();
+
+    irq_leave_protection(state);
+    return 0;
+}
+
+/**
+ * @brief 获取进程的nice值，进程不存在时返回TASK_NICE_MAX + 1
+ */
+int sys_getpriority(int pid)
+{
+    irq_state_t state = irq_enter_protection();
+
+    task_t *task = find_task(pid);
+    int nice = task ? task->prio - TASK_PRIO_DEFAULT : TASK_NICE_MAX + 1;
+
+    irq_leave_protection(state);
+    return nice;
+}
+
 task_t *task_current(void)
 {
-    return task_manager.curr_task;
+    // 读取期间不能被切换到其它CPU
+    irq_state_t state = read_eflags();
+    cli();
+    task_t *task = task_this_rq()->curr_task;
+    write_eflags(state);
+    return task;
+}
+
+/**
+ * @brief 返回当前进程，内核线程代进程执行时返回其所代表的进程
+ */
+task_t *task_current_proc(void)
+{
+    task_t *task = task_current();
+    return task->owner ? task->owner : task;
 }
 
 int sys_yield(void)
 {
     irq_state_t state = irq_enter_protection();
 
-    if (list_count(&task_manager.ready_list) > 1)
+    // 只让给同优先级的进程，更高优先级的就绪时当前进程不会在运行
+    task_t *curr_task = task_current();
+    if (list_count(&task_this_rq()->ready_list[curr_task->prio]) > 1)
     {
-        task_t *curr_task = task_current();
-
         task_set_block(curr_task);
         task_set_ready(curr_task);
 
@@ -328,37 +704,61 @@ int sys_yield(void)
     return 0;
 }
 
+/**
+ * 子进程不再使用父进程的地址空间，唤醒等待的父进程
+ */
+static void task_vfork_release(task_t *task)
+{
+    irq_state_t state = irq_enter_protection();
+
+    if (task->vfork_parent)
+    {
+        task_set_ready(task->vfork_parent);
+        task->vfork_parent = (task_t *)0;
+    }
+
+    irq_leave_protection(state);
+}
+
 int sys_wait(int *status)
 {
     task_t *curr_task = task_current();
     for (;;)
     {
-        mutex_lock(&task_table_mutex);
-        for (int i = 0; i < TASK_NR; i++)
-        {
-            task_t *task = task_table + i;
-            if (task->parent != curr_task)
-                continue;
+        irq_state_t state = irq_enter_protection();
 
-            if (task->state == TASK_ZOMBIE)
+        task_t *zombie = (task_t *)0;
+        irq_state_t list_state = spin_lock_irqsave(&task_manager.list_lock);
+        list_node_t *node = list_first(&task_manager.task_list);
+        while (node)
+        {
+            task_t *task = list_node_parent(node, task_t, all_node);
+            node = list_node_next(node);
+            if ((task->parent == curr_task) && (task->state == TASK_ZOMBIE))
             {
-                int pid = task->pid;
-                *status = task->status;
+                zombie = task;
+                break;
+            }
+        }
+        spin_unlock_irqrestore(&task_manager.list_lock, list_state);
+
+        if (zombie)
+        {
+            irq_leave_protection(state);
 
-                memory_destroy_uvm(task->tss.cr3);
-                memory_free_page(task->tss.esp0 - MEM_PAGE_SIZE);
-                kernel_memset(task, 0, sizeof(task_t));
+            int pid = zombie->pid;
+            *status = zombie->status;
 
-                mutex_unlock(&task_table_mutex);
-                return pid;
-            }
+            task_uninit(zombie);
+            free_task(zombie);
+            return pid;
         }
 
-        mutex_unlock(&task_table_mutex);
-        irq_state_t state = irq_enter_protection();
         task_set_block(curr_task);
         curr_task->state = TASK_WAITING;
         task_dispatch();
+
+        irq_leave_protection(state);
     }
 
     return 0;
@@ -368,6 +768,9 @@ void sys_exit(int status)
 {
     task_t *curr_task = task_current();
 
+    // 队列线程还在使用进程的文件和地址空间，先停止
+    ring_release(curr_task);
+
     for (int fd = 0; fd < TASK_OFILE_NR; fd++)
     {
         file_t *file = curr_task->file_table[fd];
@@ -378,21 +781,38 @@ void sys_exit(int status)
         }
     }
 
+    if (curr_task->vfork_parent)
+    {
+        // 地址空间属于父进程，父进程恢复运行后可能随时退出并释放
+        // 先换到内核的页目录再唤醒父进程，之后被切换回来也不会再用到它
+        curr_task->cr3 = memory_kernel_page_dir();
+        mmu_set_page_dir(curr_task->cr3);
+        task_vfork_release(curr_task);
+    }
+    else
+        memory_sync_regions(&curr_task->region_list, curr_task->cr3);
+
+    // 区域中引用了程序文件，退出时一并释放
+    memory_free_regions(&curr_task->region_list);
+
     int move_child = 0;
-    mutex_lock(&task_table_mutex);
-    for (int i = 0; i < TASK_NR; i++)
+    irq_state_t state = irq_enter_protection();
+
+    irq_state_t list_state = spin_lock_irqsave(&task_manager.list_lock);
+    list_node_t *node = list_first(&task_manager.task_list);
+    while (node)
     {
-        task_t *task = task_table + i;
+        task_t *task = list_node_parent(node, task_t, all_node);
         if (task->parent == curr_task)
         {
             task->parent = &task_manager.first_task;
             if (task->state == TASK_ZOMBIE)
                 move_child = 1;
         }
-    }
-    mutex_unlock(&task_table_mutex);
 
-    irq_state_t state = irq_enter_protection();
+        node = list_node_next(node);
+    }
+    spin_unlock_irqrestore(&task_manager.list_lock, list_state);
 
     task_t *parent = curr_task->parent;
     if (move_child && (parent != &task_manager.first_task))
@@ -415,18 +835,72 @@ void task_dispatch(void)
 {
     irq_state_t state = irq_enter_protection();
 
+    task_rq_t *rq = task_this_rq();
     task_t *to = task_next_run();
-    if (to != task_manager.curr_task)
+    if (to != rq->curr_task)
     {
-        task_t *from = task_current();
-        task_manager.curr_task = to;
+        task_t *from = rq->curr_task;
+        if (from == &rq->idle_task)
+            time_idle_exit();
+
+        rq->curr_task = to;
         to->state = TASK_RUNNING;
         task_switch_from_to(from, to);
     }
     irq_leave_protection(state);
 }
 
-void task_time_tick()
+/**
+ * @brief 时间走过ms毫秒，从队首扣除差值，唤醒所有到期的任务
+ */
+void task_sleep_advance(uint32_t ms)
+{
+    list_node_t *curr;
+    while ((curr = list_first(&task_manager.sleep_list)) != (list_node_t *)0)
+    {
+        task_t *task = list_node_parent(curr, task_t, run_node);
+        if (task->sleep_ms > ms)
+        {
+            task->sleep_ms -= ms;
+            break;
+        }
+
+        ms -= task->sleep_ms;
+        task->sleep_ms = 0;
+        task_set_wakeup(task);
+        task_set_ready(task);
+
+        // 如果任务同时在等待某种事件，从等待队列中移除
+        if(task->wait_list)
+        {
+            task->status = TASK_STATUS_TMO;
+            list_remove(task->wait_list, &task->wait_node);
+            task->wait_list = (list_t *)0;
+        }
+    }
+}
+
+/**
+ * @brief 距最早到期的睡眠任务的毫秒数，没有时返回-1
+ */
+int task_sleep_remain(void)
+{
+    list_node_t *node = list_first(&task_manager.sleep_list);
+    return node ? list_node_parent(node, task_t, run_node)->sleep_ms : -1;
+}
+
+/**
+ * 当前CPU是否有任务可运行，包括能从其它CPU取来的
+ */
+int task_has_ready(void)
+{
+    return (task_this_rq()->ready_bitmap != 0) || task_find_steal();
+}
+
+/**
+ * @brief 定时器中断调用，ms为距上次调用实际走过的时间
+ */
+void task_time_tick(uint32_t ms)
 {
     task_t *curr_task = task_current();
 
@@ -436,45 +910,56 @@ void task_time_tick()
 
         task_set_block(curr_task);
         task_set_ready(curr_task);
-
-        task_dispatch();
     }
 
-    list_node_t *curr = list_first(&task_manager.sleep_list);
-    while (curr)
-    {
-        task_t *task = list_node_parent(curr, task_t, run_node);
-        list_node_t *next = curr->next;
-        if (--task->sleep_ticks == 0)
-        {
-            task_set_wakeup(task);
-            task_set_ready(task);
-
-            // 如果任务同时在等待某种事件，从等待队列中移除
-            if(task->wait_list)
-            {
-                task->status = TASK_STATUS_TMO;
-                list_remove(task->wait_list, &task->wait_node);
-                task->wait_list = (list_t *)0;
-            }
-        }
+    task_sleep_advance(ms);
 
-        curr = next;
-    }
+    // 时间片用完，或唤醒了优先级更高的进程时切换
+    task_dispatch();
 }
 
-void task_set_sleep(task_t *task, uint32_t ticks)
+/**
+ * @brief 睡眠队列按到期时间排序，每项只记录与前一项的差值
+ * 插入时查找位置，时间走过时只需从队首扣除
+ */
+void task_set_sleep(task_t *task, uint32_t ms)
 {
-    if (ticks == 0)
+    if (ms == 0)
         return;
 
-    task->sleep_ticks = ticks;
+    // 到期时间相同的按先后顺序排在后面
+    list_node_t *node = list_first(&task_manager.sleep_list);
+    while (node)
+    {
+        task_t *next = list_node_parent(node, task_t, run_node);
+        if (ms < next->sleep_ms)
+        {
+            next->sleep_ms -= ms;
+            break;
+        }
+
+        ms -= next->sleep_ms;
+        node = list_node_next(node);
+    }
+
+    task->sleep_ms = ms;
     task->state = TASK_SLEEPING;
-    list_insert_last(&task_manager.sleep_list, &task->run_node);
+    list_insert_before(&task_manager.sleep_list, node, &task->run_node);
+
+#if OS_TICKLESS
+    // 睡眠队列由BSP推进，它空闲时按原先的队首装入了单次定时，需重新计算
+    if ((list_first(&task_manager.sleep_list) == &task->run_node) && task_is_idle(task_manager.rq[0].curr_task))
+        smp_send_resched(0);
+#endif
 }
 
 void task_set_wakeup(task_t *task)
 {
+    // 提前移除时，剩余的差值累加到后一项
+    list_node_t *next = list_node_next(&task->run_node);
+    if (next)
+        list_node_parent(next, task_t, run_node)->sleep_ms += task->sleep_ms;
+
     list_remove(&task_manager.sleep_list, &task->run_node);
 }
 
@@ -484,6 +969,56 @@ int sys_getpid(void)
     return task->pid;
 }
 
+/**
+ * @brief 获取各进程的状态及内存使用，返回填写的项数
+ */
+int sys_taskinfo(task_stat_t *stat, int count)
+{
+    // 持锁期间不能因缺页而阻塞，先调入并做写时复制
+    if ((count <= 0) || (memory_user_prepare((uint32_t)stat, count * sizeof(task_stat_t), 1) < 0))
+        return -1;
+
+    static const char state_char[] = {
+        [TASK_CRATED] = 'C',
+        [TASK_RUNNING] = 'R',
+        [TASK_SLEEPING] = 'S',
+        [TASK_READY] = 'r',
+        [TASK_WAITING] = 'W',
+        [TASK_ZOMBIE] = 'Z',
+    };
+
+    int index = 0;
+    irq_state_t state = spin_lock_irqsave(&task_manager.list_lock);
+
+    list_node_t *node = list_first(&task_manager.task_list);
+    while (node && (index < count))
+    {
+        task_t *task = list_node_parent(node, task_t, all_node);
+        task_stat_t *curr = stat + index++;
+
+        curr->pid = task->pid;
+        curr->ppid = task->parent ? task->parent->pid : 0;
+        curr->state = state_char[task->state];
+        curr->nice = task->prio - TASK_PRIO_DEFAULT;
+        curr->cpu = task->cpu;
+        kernel_strncpy(curr->name, task->name, TASK_STAT_NAME_SIZE);
+        curr->page_fault = task->page_fault;
+        curr->cow_copy = task->cow_copy;
+
+        // 内核线程借用其它进程的页目录，vfork的子进程与父进程共用，都不单独计算
+        if ((task->flags & TASK_FLAGS_SYSTEM) || task->vfork_parent || !task->cr3 ||
+            (task->cr3 == memory_kernel_page_dir()))
+            curr->rss = 0;
+        else
+            curr->rss = memory_count_rss(task->cr3);
+
+        node = list_node_next(node);
+    }
+
+    spin_unlock_irqrestore(&task_manager.list_lock, state);
+    return index;
+}
+
 static void copy_opened_files(task_t *child_task)
 {
     task_t *parent = task_current();
@@ -498,91 +1033,158 @@ static void copy_opened_files(task_t *child_task)
     }
 }
 
-int sys_fork(void)
+static void close_task_files(task_t *task)
 {
-    task_t *parent_task = task_current();
+    for (int fd = 0; fd < TASK_OFILE_NR; fd++)
+    {
+        file_t *file = task->file_table[fd];
+        if (file)
+        {
+            fs_close_file(file);
+            task->file_table[fd] = (file_t *)0;
+        }
+    }
+}
 
+/**
+ * 创建子进程并复制父进程在系统调用时的寄存器状态，不处理地址空间
+ */
+static task_t *fork_task_init(task_t *parent_task)
+{
     task_t *child_task = alloc_task();
     if (child_task == (task_t *)0)
-        goto fork_failed;
+        return (task_t *)0;
 
-    syscall_frame_t *frame = (syscall_frame_t *)(parent_task->tss.esp0 - sizeof(syscall_frame_t));
+    syscall_frame_t *frame = (syscall_frame_t *)(parent_task->esp0 - sizeof(syscall_frame_t));
 
     int err = task_init(child_task, parent_task->name, 0, frame->eip, frame->esp + sizeof(uint32_t) * SYSCALL_PARAM_COUNT);
     if (err < 0)
-        goto fork_failed;
+    {
+        task_uninit(child_task);
+        free_task(child_task);
+        return (task_t *)0;
+    }
 
     // 拷贝打开的文件
     copy_opened_files(child_task);
-
-    tss_t *tss = &child_task->tss;
-    tss->eax = 0;
-    tss->ebx = frame->ebx;
-    tss->ecx = frame->ecx;
-    tss->edx = frame->edx;
-    tss->esi = frame->esi;
-    tss->edi = frame->edi;
-    tss->ebp = frame->ebp;
-
-    tss->cs = frame->cs;
-    tss->ds = frame->ds;
-    tss->es = frame->es;
-    tss->fs = frame->fs;
-    tss->gs = frame->gs;
-    tss->eflags = frame->eflags;
+    task_set_priority(child_task, parent_task->prio);
+
+    task_frame_t *child_frame = (task_frame_t *)child_task->stack;
+    child_frame->eax = 0;
+    child_frame->ebx = frame->ebx;
+    child_frame->ecx = frame->ecx;
+    child_frame->edx = frame->edx;
+    child_frame->esi = frame->esi;
+    child_frame->edi = frame->edi;
+    child_frame->ebp = frame->ebp;
+
+    child_frame->cs = frame->cs;
+    child_frame->ds = frame->ds;
+    child_frame->es = frame->es;
+    child_frame->fs = frame->fs;
+    child_frame->gs = frame->gs;
+    child_frame->eflags = frame->eflags;
 
     child_task->parent = parent_task;
+    return child_task;
+}
+
+int sys_fork(void)
+{
+    task_t *parent_task = task_current();
+
+    task_t *child_task = fork_task_init(parent_task);
+    if (child_task == (task_t *)0)
+        return -1;
+
+    // 共享映射需先全部调入，否则父子进程缺页时会各自分配
+    if (memory_fault_in_shared(&parent_task->region_list) < 0)
+        goto fork_failed;
+
+    // 与父进程共享物理页(写时复制)，替换掉task_init时创建的空页表
+    // 父进程的页随之改为只读，不能与队列线程正在进行的读写同时发生
+    ring_pause(parent_task);
+    uint32_t page_dir = memory_copy_uvm(parent_task->cr3);
+    ring_resume(parent_task);
+    if (page_dir == 0)
+        goto fork_failed;
+
+    memory_destroy_uvm(child_task->cr3);
+    child_task->cr3 = page_dir;
 
-    if ((tss->cr3 = memory_copy_uvm(parent_task->tss.cr3)) < 0)
+    if (memory_copy_regions(&child_task->region_list, &parent_task->region_list) < 0)
         goto fork_failed;
 
     task_start(child_task);
     return child_task->pid;
 fork_failed:
-    if (child_task)
-    {
-        task_uninit(child_task);
-        free_task(child_task);
-    }
+    close_task_files(child_task);
+    task_uninit(child_task);
+    free_task(child_task);
     return -1;
 }
 
-static int load_phdr(int file, Elf32_Phdr *phdr, uint32_t page_dir)
+/**
+ * @brief 创建子进程但不复制地址空间，子进程直接使用父进程的页表
+ * 父进程挂起，直到子进程调用execve或退出
+ */
+int sys_vfork(void)
 {
-    int err = memory_alloc_for_page_dir(page_dir, phdr->p_vaddr, phdr->p_memsz, PTE_P | PTE_U | PTE_W);
-    if (err < 0)
-    {
-        log_printf("no memory");
+    task_t *parent_task = task_current();
+
+    task_t *child_task = fork_task_init(parent_task);
+    if (child_task == (task_t *)0)
         return -1;
-    }
 
-    if (sys_lseek(file, phdr->p_offset, 0) < 0)
+    // 子进程仍可能缺页，需要一份区域描述
+    if (memory_copy_regions(&child_task->region_list, &parent_task->region_list) < 0)
     {
-        log_printf("read file failed");
+        close_task_files(child_task);
+        task_uninit(child_task);
+        free_task(child_task);
         return -1;
     }
 
-    uint32_t vaddr = phdr->p_vaddr;
-    uint32_t size = phdr->p_filesz;
-    while (size > 0)
-    {
-        int curr_size = (size > MEM_PAGE_SIZE) ? MEM_PAGE_SIZE : size;
-        uint32_t paddr = memory_get_paddr(page_dir, vaddr);
+    memory_destroy_uvm(child_task->cr3);
+    child_task->cr3 = parent_task->cr3;
+    child_task->vfork_parent = parent_task;
 
-        if (sys_read(file, (char *)paddr, curr_size) < curr_size)
-        {
-            log_printf("read file failed.");
-            return -1;
-        }
+    // 子进程只能被父进程回收，父进程挂起期间不会被释放
+    int pid = child_task->pid;
+
+    irq_state_t state = irq_enter_protection();
+    task_set_ready(child_task);
+    task_set_block(parent_task);
+    task_dispatch();
+    irq_leave_protection(state);
+
+    return pid;
+}
 
-        size -= curr_size;
-        vaddr += curr_size;
+static int load_phdr(int file, Elf32_Phdr *phdr, list_t *region_list)
+{
+    uint32_t perm = PTE_P | PTE_U;
+    if (phdr->p_flags & PF_W)
+        perm |= PTE_W;
+
+    // 只登记区域，页面在首次访问时才从文件中读入
+    mem_region_t *region = memory_add_file_region(region_list, phdr->p_vaddr, phdr->p_memsz,
+                                                  perm, task_file(file),
+                                                  phdr->p_offset, phdr->p_filesz);
+    if (region == (mem_region_t *)0)
+    {
+        log_printf("no memory region");
+        return -1;
     }
 
+    // 只读段的页由运行同一程序的进程共享，映像获取失败时各自装入
+    if (!(phdr->p_flags & PF_W))
+        region->image = image_get(task_file(file));
+
     return 0;
 }
 
-static uint32_t load_elf_file(task_t *task, const char *name, uint32_t page_dir)
+static uint32_t load_elf_file(task_t *task, const char *name, list_t *region_list)
 {
     Elf32_Ehdr elf_hdr;
     Elf32_Phdr elf_phdr;
@@ -629,7 +1231,7 @@ static uint32_t load_elf_file(task_t *task, const char *name, uint32_t page_dir)
         if (elf_phdr.p_type != 1 || elf_phdr.p_vaddr < MEMORY_TASK_BASE)
             continue;
 
-        int err = load_phdr(file, &elf_phdr, page_dir);
+        int err = load_phdr(file, &elf_phdr, region_list);
         if (err < 0)
         {
             log_printf("load program failed.s");
@@ -644,10 +1246,10 @@ static uint32_t load_elf_file(task_t *task, const char *name, uint32_t page_dir)
     return elf_hdr.e_entry;
 
 load_failed:
-    if (file)
+    if (file >= 0)
         sys_close(file);
 
-    return -1;
+    return 0;
 }
 
 static int copy_args(char *to, uint32_t page_dir, int argc, char **argv)
@@ -656,8 +1258,9 @@ static int copy_args(char *to, uint32_t page_dir, int argc, char **argv)
     task_args.argc = argc;
     task_args.argv = (char **)(to + sizeof(task_args_t));
 
+    // 参数表也经由memory_copy_uvm_data写入，参数页不一定能按物理地址直接访问
     char *dest_arg = to + sizeof(task_args_t) + sizeof(char *) * (argc + 1);
-    char **dest_arg_tb = (char **)memory_get_paddr(page_dir, (uint32_t)(to + sizeof(task_args_t)));
+    char **dest_arg_tb = task_args.argv;
     for (int i = 0; i < argc; i++)
     {
         char *from = argv[i];
@@ -667,12 +1270,18 @@ static int copy_args(char *to, uint32_t page_dir, int argc, char **argv)
                                        (uint32_t)from,
                                        len);
         ASSERT(err >= 0);
-        dest_arg_tb[i] = dest_arg;
+
+        err = memory_copy_uvm_data((uint32_t)(dest_arg_tb + i), page_dir,
+                                   (uint32_t)&dest_arg, sizeof(char *));
+        ASSERT(err >= 0);
         dest_arg += len;
     }
 
     if (argc)
-        dest_arg_tb[argc] = '\0';
+    {
+        char *end = (char *)0;
+        memory_copy_uvm_data((uint32_t)(dest_arg_tb + argc), page_dir, (uint32_t)&end, sizeof(char *));
+    }
 
     return memory_copy_uvm_data((uint32_t)to,
                                 page_dir,
@@ -680,56 +1289,384 @@ static int copy_args(char *to, uint32_t page_dir, int argc, char **argv)
                                 sizeof(task_args));
 }
 
+/**
+ * 为任务建立新程序的地址空间：登记各段、堆和栈的区域，并写入启动参数
+ * argv位于当前进程的地址空间中
+ */
+static uint32_t load_image(task_t *task, const char *name, char **argv,
+                           uint32_t page_dir, list_t *region_list)
+{
+    uint32_t entry = load_elf_file(task, name, region_list);
+    if (entry == 0)
+        return 0;
+
+    // 堆和栈只登记区域，首次访问时才分配清零的页
+    mem_region_t *region = memory_add_region(region_list, up2(task->heap_start, MEM_PAGE_SIZE),
+                                             up2(task->heap_start, MEM_PAGE_SIZE),
+                                             PTE_P | PTE_U | PTE_W);
+    if (region == (mem_region_t *)0)
+        return 0;
+    region->flags = MEM_REGION_HEAP;
+
+    // 栈底留出一页不映射，栈溢出时触发缺页异常
+    region = memory_add_region(region_list,
+                               MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE + MEM_TASK_STACK_GUARD_SIZE,
+                               MEM_TASK_STACK_TOP, PTE_P | PTE_U | PTE_W);
+    if (region == (mem_region_t *)0)
+        return 0;
+    region->flags = MEM_REGION_STACK;
+
+    // 参数区由内核直接写入新页表，预先分配
+    uint32_t stack_top = MEM_TASK_STACK_TOP - MEM_TASK_ARG_SIZE;
+    int err = memory_alloc_for_page_dir(page_dir, stack_top,
+                                        MEM_TASK_ARG_SIZE,
+                                        PTE_P | PTE_U | PTE_W);
+    if (err < 0)
+        return 0;
+
+    int argc = strings_count(argv);
+    err = copy_args((char *)stack_top, page_dir, argc, argv);
+    if (err < 0)
+        return 0;
+
+    return entry;
+}
+
 int sys_execve(char *name, char **argv, char **env)
 {
     task_t *task = task_current();
 
     kernel_strcpy(task->name, get_file_name(name));
 
-    uint32_t old_page_dir = task->tss.cr3;
+    uint32_t old_page_dir = task->cr3;
+
+    list_t region_list;
+    list_init(&region_list);
 
     uint32_t new_page_dir = memory_create_uvm();
     if (!new_page_dir)
         goto exec_failed;
 
-    uint32_t entry = load_elf_file(task, name, new_page_dir);
+    uint32_t entry = load_image(task, name, argv, new_page_dir, &region_list);
     if (entry == 0)
         goto exec_failed;
 
     uint32_t stack_top = MEM_TASK_STACK_TOP - MEM_TASK_ARG_SIZE;
-    int err = memory_alloc_for_page_dir(new_page_dir,
-                                        MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE,
-                                        MEM_TASK_STACK_SIZE,
-                                        PTE_P | PTE_U | PTE_W);
-    if (err < 0)
-        goto exec_failed;
-
-    int argc = strings_count(argv);
-    err = copy_args((char *)stack_top, new_page_dir, argc, argv);
-    if (err < 0)
-        goto exec_failed;
-
-    syscall_frame_t *frame = (syscall_frame_t *)(task->tss.esp0 - sizeof(syscall_frame_t));
+    syscall_frame_t *frame = (syscall_frame_t *)(task->esp0 - sizeof(syscall_frame_t));
     frame->eip = entry;
     frame->eax = frame->ebx = frame->ecx = frame->edx = 0;
     frame->esi = frame->edi = frame->ebp = 0;
     frame->eflags = EFLAGS_IF | EFLAGS_DEFAULT;
     frame->esp = stack_top - sizeof(uint32_t) * SYSCALL_PARAM_COUNT;
 
-    task->tss.cr3 = new_page_dir;
+    // 队列中的操作属于旧的地址空间
+    ring_release(task);
+
+    task->cr3 = new_page_dir;
     mmu_set_page_dir(new_page_dir);
+    memory_vdata_set_pid(new_page_dir, task->pid);
 
-    memory_destroy_uvm(old_page_dir);
+    // vfork的子进程借用的是父进程的地址空间，不能释放
+    if (task->vfork_parent)
+        task_vfork_release(task);
+    else
+    {
+        memory_sync_regions(&task->region_list, old_page_dir);
+        memory_destroy_uvm(old_page_dir);
+    }
+
+    memory_free_regions(&task->region_list);
+    task->region_list = region_list;
 
     return 0;
 
 exec_failed:
+    memory_free_regions(&region_list);
     if (new_page_dir)
     {
-        task->tss.cr3 = old_page_dir;
+        task->cr3 = old_page_dir;
         mmu_set_page_dir(old_page_dir);
 
         memory_destroy_uvm(new_page_dir);
     }
     return -1;
 }
+
+/**
+ * 在子进程的文件表上依次执行spawn指定的文件操作
+ */
+static int spawn_file_actions(task_t *task, spawn_action_t *action)
+{
+    for (; action && (action->type != SPAWN_ACTION_END); action++)
+    {
+        if ((action->fd < 0) || (action->fd >= TASK_OFILE_NR))
+            return -1;
+
+        file_t *file = task->file_table[action->fd];
+        switch (action->type)
+        {
+        case SPAWN_ACTION_DUP2:
+            if ((file == (file_t *)0) || (action->new_fd < 0) || (action->new_fd >= TASK_OFILE_NR))
+                return -1;
+
+            if (action->new_fd == action->fd)
+                break;
+
+            if (task->file_table[action->new_fd])
+                fs_close_file(task->file_table[action->new_fd]);
+
+            file_inc_ref(file);
+            task->file_table[action->new_fd] = file;
+            break;
+        case SPAWN_ACTION_CLOSE:
+            if (file)
+            {
+                fs_close_file(file);
+                task->file_table[action->fd] = (file_t *)0;
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 直接从程序文件创建子进程，不复制父进程的地址空间
+ * 子进程继承父进程打开的文件，再按actions调整
+ */
+int sys_spawn(const char *name, char **argv, char **env, spawn_action_t *actions)
+{
+    task_t *parent_task = task_current();
+
+    task_t *child_task = alloc_task();
+    if (child_task == (task_t *)0)
+        return -1;
+
+    uint32_t stack_top = MEM_TASK_STACK_TOP - MEM_TASK_ARG_SIZE;
+    if (task_init(child_task, get_file_name(name), 0, 0, stack_top) < 0)
+    {
+        task_uninit(child_task);
+        free_task(child_task);
+        return -1;
+    }
+
+    uint32_t entry = load_image(child_task, name, argv, child_task->cr3, &child_task->region_list);
+    if (entry == 0)
+        goto spawn_failed;
+    ((task_frame_t *)child_task->stack)->eip = entry;
+    task_set_priority(child_task, parent_task->prio);
+
+    copy_opened_files(child_task);
+    if (spawn_file_actions(child_task, actions) < 0)
+        goto spawn_failed;
+
+    child_task->parent = parent_task;
+    task_start(child_task);
+    return child_task->pid;
+
+spawn_failed:
+    close_task_files(child_task);
+    task_uninit(child_task);
+    free_task(child_task);
+    return -1;
+}
+
+#if OS_BENCH
+#define BENCH_SLEEPER_NR 512
+#define BENCH_SLEEP_MAX 1000 // 最长睡眠的tick数
+
+/**
+ * 测试用的睡眠项，放在私有的队列中，不涉及调度
+ */
+typedef struct _bench_sleeper_t
+{
+    list_node_t node;
+    int sleep;
+} bench_sleeper_t;
+
+static bench_sleeper_t bench_sleepers[BENCH_SLEEPER_NR];
+
+/**
+ * 与task_set_sleep相同，按到期时间插入差值队列
+ */
+static void bench_delta_insert(list_t *list, bench_sleeper_t *sleeper, int ms)
+{
+    list_node_t *node = list_first(list);
+    while (node)
+    {
+        bench_sleeper_t *next = list_node_parent(node, bench_sleeper_t, node);
+        if (ms < next->sleep)
+        {
+            next->sleep -= ms;
+            break;
+        }
+
+        ms -= next->sleep;
+        node = list_node_next(node);
+    }
+
+    sleeper->sleep = ms;
+    list_insert_before(list, node, &sleeper->node);
+}
+
+/**
+ * 与task_sleep_advance相同，只从队首扣除，移除到期的项
+ */
+static void bench_delta_advance(list_t *list, int ms)
+{
+    list_node_t *curr;
+    while ((curr = list_first(list)) != (list_node_t *)0)
+    {
+        bench_sleeper_t *sleeper = list_node_parent(curr, bench_sleeper_t, node);
+        if (sleeper->sleep > ms)
+        {
+            sleeper->sleep -= ms;
+            break;
+        }
+
+        ms -= sleeper->sleep;
+        list_remove(list, curr);
+    }
+}
+
+/**
+ * 原方式：每个tick给所有睡眠项减一，移除到期的项
+ */
+static void bench_scan_tick(list_t *list)
+{
+    list_node_t *curr = list_first(list);
+    while (curr)
+    {
+        bench_sleeper_t *sleeper = list_node_parent(curr, bench_sleeper_t, node);
+        list_node_t *next = list_node_next(curr);
+        if (--sleeper->sleep == 0)
+            list_remove(list, curr);
+
+        curr = next;
+    }
+}
+
+/**
+ * 用大量睡眠项在私有队列上测试：插入开销、直到全部到期的平均每tick开销
+ * 并与原先每个tick遍历整个队列、逐项递减的方式对比
+ */
+void task_sleep_bench(void)
+{
+    list_t list;
+
+    list_init(&list);
+    uint32_t seed = 1;
+    uint32_t start = read_tsc();
+    for (int i = 0; i < BENCH_SLEEPER_NR; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        bench_delta_insert(&list, bench_sleepers + i, (1 + (seed >> 16) % BENCH_SLEEP_MAX) * OS_TICK_MS);
+    }
+    uint32_t insert_cycles = read_tsc() - start;
+
+    int ticks = 0;
+    start = read_tsc();
+    while (!list_is_empty(&list))
+    {
+        bench_delta_advance(&list, OS_TICK_MS);
+        ticks++;
+    }
+    uint32_t tick_cycles = read_tsc() - start;
+
+    // 原方式使用同样的到期时间，以tick计，插入时直接放在队尾
+    list_init(&list);
+    seed = 1;
+    start = read_tsc();
+    for (int i = 0; i < BENCH_SLEEPER_NR; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        bench_sleepers[i].sleep = 1 + (seed >> 16) % BENCH_SLEEP_MAX;
+        list_insert_last(&list, &bench_sleepers[i].node);
+    }
+    uint32_t scan_insert_cycles = read_tsc() - start;
+
+    int scan_ticks = 0;
+    start = read_tsc();
+    while (!list_is_empty(&list))
+    {
+        bench_scan_tick(&list);
+        scan_ticks++;
+    }
+    uint32_t scan_cycles = read_tsc() - start;
+
+    log_printf("bench sleep: %d sleepers, delta insert %d cycles/task, tick %d cycles",
+               BENCH_SLEEPER_NR, insert_cycles / BENCH_SLEEPER_NR, tick_cycles / ticks);
+    log_printf("bench sleep: full scan insert %d cycles/task, tick %d cycles",
+               scan_insert_cycles / BENCH_SLEEPER_NR, scan_cycles / scan_ticks);
+}
+
+#define BENCH_SWITCH_NR 10000
+#define BENCH_STACK_SIZE 256
+
+static uint32_t bench_stack[BENCH_STACK_SIZE];
+static uint32_t *bench_main_sp, *bench_peer_sp;
+static tss_t bench_tss;
+
+static void bench_hw_peer(void)
+{
+    for (;;)
+        switch_to_tss(KERNEL_SELECTOR_TSS);
+}
+
+static void bench_sw_peer(void)
+{
+    for (;;)
+        simple_switch(&bench_peer_sp, bench_main_sp);
+}
+
+/**
+ * 两个内核现场之间来回切换，对比硬件任务切换与在栈上保存现场的软件切换
+ */
+void task_switch_bench(void)
+{
+    int sel = gdt_alloc_desc();
+    if (sel < 0)
+    {
+        log_printf("bench switch: no gdt desc");
+        return;
+    }
+
+    irq_state_t state = irq_enter_protection();
+
+    // 跳回时从共用的TSS中恢复现场，CR3不在切换时保存，需先填好
+    tss_get()->cr3 = read_cr3();
+
+    kernel_memset(&bench_tss, 0, sizeof(tss_t));
+    bench_tss.eip = (uint32_t)bench_hw_peer;
+    bench_tss.esp = (uint32_t)&bench_stack[BENCH_STACK_SIZE];
+    bench_tss.eflags = EFLAGS_DEFAULT;
+    bench_tss.cr3 = read_cr3();
+    bench_tss.cs = KERNEL_SELECTOR_CS;
+    bench_tss.ss = bench_tss.ds = bench_tss.es = bench_tss.fs = bench_tss.gs = KERNEL_SELECTOR_DS;
+    segment_desc_set(sel, (uint32_t)&bench_tss, sizeof(tss_t), SEG_P_PRESENT | SEG_DPL0 | SEG_TYPE_TSS);
+
+    uint32_t start = read_tsc();
+    for (int i = 0; i < BENCH_SWITCH_NR; i++)
+        switch_to_tss(sel);
+    uint32_t hw_cycles = read_tsc() - start;
+    write_cr0(read_cr0() & ~CR0_TS);
+
+    // 与task_frame_t相同，依次弹出4个寄存器后返回到入口
+    bench_peer_sp = &bench_stack[BENCH_STACK_SIZE - 6];
+    bench_peer_sp[4] = (uint32_t)bench_sw_peer;
+
+    start = read_tsc();
+    for (int i = 0; i < BENCH_SWITCH_NR; i++)
+        simple_switch(&bench_main_sp, bench_peer_sp);
+    uint32_t sw_cycles = read_tsc() - start;
+
+    irq_leave_protection(state);
+    gdt_free_sel(sel);
+
+    log_printf("bench switch: hardware tss %d cycles, software %d cycles",
+               hw_cycles / (BENCH_SWITCH_NR * 2), sw_cycles / (BENCH_SWITCH_NR * 2));
+}
+#endif
@@ -0,0 +1,158 @@
+#include "cpu/apic.h"
+#include "cpu/irq.h"
+#include "comm/cpu_instr.h"
+#include "core/memory.h"
+#include "core/task.h"
+#include "dev/time.h"
+#include "os_cfg.h"
+#include "tools/log.h"
+
+static volatile uint32_t *lapic;
+static uint32_t ticks_per_ms; // 本地定时器16分频后每毫秒的计数
+
+static uint32_t lapic_read(int reg)
+{
+    return lapic[reg / 4];
+}
+
+static void lapic_write(int reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+    lapic[LAPIC_ID / 4]; // 读一次，等待写入完成
+}
+
+/**
+ * 用PIT通道2计时一个tick，得到本地定时器的频率，各CPU的总线频率相同
+ */
+static void lapic_calibrate(void)
+{
+    uint32_t count = PIT_OSC_FREQ * OS_TICK_MS / 1000;
+
+    // 打开通道2的门控，关闭扬声器，方式0计到0时OUT2变高
+    outb(PIT_SPEAKER_PORT, (inb(PIT_SPEAKER_PORT) & ~PIT_SPEAKER_DATA) | PIT_SPEAKER_GATE2);
+    outb(PIT_COMMAND_MODE_PORT, PIT_CHANNLE2 | PIT_LOAD_LOHI | PIT_MODE0);
+    outb(PIT_CHANNEL2_DATA_PORT, count & 0xFF);
+    outb(PIT_CHANNEL2_DATA_PORT, (count >> 8) & 0xFF);
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    while (!(inb(PIT_SPEAKER_PORT) & PIT_SPEAKER_OUT2))
+        ;
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    ticks_per_ms = elapsed / OS_TICK_MS;
+}
+
+static void lapic_enable(void)
+{
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | IRQ_SPURIOUS);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_EOI, 0);
+    lapic_write(LAPIC_TPR, 0);
+}
+
+/**
+ * @brief BSP上初始化本地APIC，8259的中断仍经LINT0送到BSP
+ */
+void lapic_init(uint32_t paddr)
+{
+    lapic = (volatile uint32_t *)memory_fixmap(MEM_FIXMAP_LAPIC, paddr);
+
+    irq_install(IRQ_LAPIC_TIMER, exception_handler_lapic_timer);
+    irq_install(IRQ_RESCHED, exception_handler_resched);
+    irq_install(IRQ_SPURIOUS, exception_handler_spurious);
+
+    lapic_enable();
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_calibrate();
+
+    log_printf("lapic: id %d, timer %d ticks/ms", lapic_id(), ticks_per_ms);
+}
+
+/**
+ * @brief AP上初始化本地APIC，没有PIT中断，由本地定时器驱动时间片
+ */
+void lapic_init_ap(void)
+{
+    lapic_enable();
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | IRQ_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, ticks_per_ms * OS_TICK_MS);
+}
+
+int lapic_id(void)
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * @brief 发送处理器间中断，调用者需关中断，两个ICR寄存器之间不能被打断
+ */
+void lapic_send_ipi(int apic_id, int vector)
+{
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+    while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+        ;
+}
+
+/**
+ * @brief 按INIT、STARTUP、STARTUP的顺序启动AP，addr为启动代码的地址，需4KB对齐
+ */
+void lapic_start_ap(int apic_id, uint32_t addr)
+{
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+    lapic_udelay(200);
+    lapic_write(LAPIC_ICR_LO, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+    lapic_udelay(10000);
+
+    // 向量为启动代码所在的页号，AP从实模式的 页号:0 处开始执行
+    for (int i = 0; i < 2; i++)
+    {
+        lapic_write(LAPIC_ICR_HI, apic_id << 24);
+        lapic_write(LAPIC_ICR_LO, LAPIC_ICR_STARTUP | (addr >> 12));
+        lapic_udelay(200);
+    }
+}
+
+/**
+ * @brief 用本地定时器忙等，定时器须未在周期模式下运行，只在启动AP时使用
+ */
+void lapic_udelay(int us)
+{
+    lapic_write(LAPIC_TIMER_INIT, ticks_per_ms * us / 1000 + 1);
+    while (lapic_read(LAPIC_TIMER_CURR) != 0)
+        ;
+}
+
+void do_handler_lapic_timer(exception_frame_t *frame)
+{
+    lapic_eoi();
+
+    // 系统时钟和睡眠队列由BSP上的PIT推进，这里只计算时间片
+    task_time_tick(0);
+}
+
+void do_handler_resched(exception_frame_t *frame)
+{
+    lapic_eoi();
+    task_dispatch();
+}
+
+void do_handler_spurious(exception_frame_t *frame)
+{
+}
@@ -6,7 +6,9 @@
 #include "ipc/mutex.h"
 
 static segment_desc_t gdt_table[GDT_TABLE_SIZE];
+static tss_t tss_table[OS_CPU_MAX];
 static mutex_t mutex;
+static int sysenter_enabled;
 
 void segment_desc_set(int selector, uint32_t base,
                       uint32_t limit, uint16_t attr)
@@ -77,14 +79,55 @@ void init_gdt(void)
                      SEG_P_PRESENT | SEG_DPL0 | SEG_S_NORMAL |
                          SEG_TYPE_CODE | SEG_TYPE_RW | SEG_D | SEG_G);
 
+    // 用户的代码段、数据段，位置固定，以便sysexit返回
+    segment_desc_set(APP_SELECTOR_CS, 0x00000000, 0xFFFFFFFF,
+                     SEG_P_PRESENT | SEG_DPL3 | SEG_S_NORMAL |
+                         SEG_TYPE_CODE | SEG_TYPE_RW | SEG_D);
+
+    segment_desc_set(APP_SELECTOR_DS, 0x00000000, 0xFFFFFFFF,
+                     SEG_P_PRESENT | SEG_DPL3 | SEG_S_NORMAL |
+                         SEG_TYPE_DATA | SEG_TYPE_RW | SEG_D);
+
     gate_desc_set((gate_desc_t *)(gdt_table + (SELECTOR_SYSCALL >> 3)),
                   KERNEL_SELECTOR_CS,
                   (uint32_t)exception_handler_syscall,
                   GATE_P_PRESENT | GATE_DPL3 | GATE_TYPE_SYSCALL | SYSCALL_PARAM_COUNT);
 
+    // 任务切换由软件完成，TSS只提供从用户态进入内核时使用的栈
+    for (int i = 0; i < OS_CPU_MAX; i++)
+    {
+        segment_desc_set(KERNEL_SELECTOR_TSS + i * 8, (uint32_t)(tss_table + i), sizeof(tss_t),
+                         SEG_P_PRESENT | SEG_DPL0 | SEG_TYPE_TSS);
+    }
+
     lgdt((uint32_t)gdt_table, sizeof(gdt_table));
 }
 
+static void init_tss(void)
+{
+    for (int i = 0; i < OS_CPU_MAX; i++)
+        tss_table[i].ss0 = KERNEL_SELECTOR_DS;
+
+    write_tr(KERNEL_SELECTOR_TSS);
+}
+
+/**
+ * 支持时设置sysenter的入口，进入时使用的栈在切换任务时更新
+ * 不支持时应用仍经调用门进入内核
+ */
+static void init_sysenter(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP))
+        return;
+
+    write_msr(MSR_SYSENTER_CS, KERNEL_SELECTOR_CS);
+    write_msr(MSR_SYSENTER_EIP, (uint32_t)exception_handler_sysenter);
+    write_msr(MSR_SYSENTER_ESP, 0);
+    sysenter_enabled = 1;
+}
+
 /**
  * CPU初始化
  */
@@ -92,12 +135,44 @@ void cpu_init(void)
 {
     mutex_init(&mutex);
     init_gdt();
+    init_tss();
+    init_sysenter();
 }
 
 /**
- * 切换至TSS，即跳转实现任务切换
+ * AP启动后装入自己的TSS，GDT已由启动代码装入
+ */
+void cpu_init_ap(int id)
+{
+    write_tr(KERNEL_SELECTOR_TSS + id * 8);
+    init_sysenter();
+}
+
+/**
+ * 当前CPU的编号，由装入的TSS选择子区分，装入之前只有BSP在运行
+ */
+int cpu_id(void)
+{
+    uint16_t tss_sel = read_tr();
+    return tss_sel ? (tss_sel - KERNEL_SELECTOR_TSS) >> 3 : 0;
+}
+
+/**
+ * 切换至TSS，即跳转实现任务切换，仅用于与软件切换的性能对比
  */
 void switch_to_tss(int tss_sel)
 {
     far_jump(tss_sel, 0);
-}
\ No newline at end of file
+}
+
+void tss_set_esp0(uint32_t esp0)
+{
+    tss_table[cpu_id()].esp0 = esp0;
+    if (sysenter_enabled)
+        write_msr(MSR_SYSENTER_ESP, esp0);
+}
+
+tss_t *tss_get(void)
+{
+    return tss_table + cpu_id();
+}
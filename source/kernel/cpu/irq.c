@@ -4,10 +4,14 @@
 #include "os_cfg.h"
 #include "tools/log.h"
 #include "core/task.h"
+#include "core/memory.h"
+#include "ipc/spinlock.h"
 
 #define IDT_TABLE_NR 128
 
 static gate_desc_t idt_table[IDT_TABLE_NR];
+static spinlock_t kernel_lock;         // 大内核锁，同一时刻只有一个CPU访问内核中的共享数据
+static int lock_depth[OS_CPU_MAX];     // 各CPU持有内核锁的嵌套深度
 
 static void dump_core_regs(exception_frame_t *frame)
 {
@@ -165,6 +169,10 @@ void do_handler_general_protection(exception_frame_t *frame)
 
 void do_handler_page_fault(exception_frame_t *frame)
 {
+    // 写时复制等可恢复的缺页，处理完成后直接返回重新执行
+    if (memory_handle_page_fault(read_cr2(), frame->error_code) == 0)
+        return;
+
     log_printf("--------------------------------");
     log_printf("IRQ/Exception happened: Page fault.");
     if (frame->error_code & ERR_PAGE_P)
@@ -178,20 +186,20 @@ void do_handler_page_fault(exception_frame_t *frame)
 
     if (frame->error_code & ERR_PAGE_WR)
     {
-        log_printf("\tThe access causing the fault was a read.");
+        log_printf("\tThe access causing the fault was a write.");
     }
     else
     {
-        log_printf("\tThe access causing the fault was a write.");
+        log_printf("\tThe access causing the fault was a read.");
     }
 
     if (frame->error_code & ERR_PAGE_US)
     {
-        log_printf("\tA supervisor-mode access caused the fault.");
+        log_printf("\tA user-mode access caused the fault.");
     }
     else
     {
-        log_printf("\tA user-mode access caused the fault.");
+        log_printf("\tA supervisor-mode access caused the fault.");
     }
 
     dump_core_regs(frame);
@@ -296,9 +304,18 @@ void irq_init(void)
 
     lidt((uint32_t)idt_table, sizeof(idt_table));
 
+    spin_init(&kernel_lock);
     init_pic();
 }
 
+/**
+ * AP与BSP共用同一个IDT，PIC的中断只送到BSP
+ */
+void irq_init_ap(void)
+{
+    lidt((uint32_t)idt_table, sizeof(idt_table));
+}
+
 int irq_install(int irq_num, irq_handler_t handler)
 {
     if (irq_num >= IDT_TABLE_NR)
@@ -370,14 +387,63 @@ void pic_send_eoi(int irq_num)
     outb(PIC0_OCW2, PIC_OCW2_EOI);
 }
 
+static void kernel_lock_get(void)
+{
+    if (lock_depth[cpu_id()]++ == 0)
+        spin_lock(&kernel_lock);
+}
+
+static void kernel_lock_put(void)
+{
+    if (--lock_depth[cpu_id()] == 0)
+        spin_unlock(&kernel_lock);
+}
+
+/**
+ * @brief 关中断并获取内核锁，可嵌套
+ */
 irq_state_t irq_enter_protection(void)
 {
     irq_state_t state = read_eflags();
     irq_disable_global();
+    kernel_lock_get();
     return state;
 }
 
 void irq_leave_protection(irq_state_t state)
 {
+    kernel_lock_put();
     write_eflags(state);
+}
+
+/**
+ * @brief 进入内核时获取内核锁，不改变中断状态
+ * 系统调用在开中断时进入，修改嵌套深度期间需关中断，避免被本CPU上的中断打断
+ */
+void irq_lock_kernel(void)
+{
+    irq_state_t state = read_eflags();
+    irq_disable_global();
+    kernel_lock_get();
+    write_eflags(state);
+}
+
+void irq_unlock_kernel(void)
+{
+    irq_state_t state = read_eflags();
+    irq_disable_global();
+    kernel_lock_put();
+    write_eflags(state);
+}
+
+/**
+ * @brief 任务切换时交换当前CPU的锁嵌套深度，返回切换出去的任务的深度
+ * 切换时内核锁一直被当前CPU持有，深度随任务保存，任务可在其它CPU上恢复
+ */
+int irq_swap_lock_depth(int depth)
+{
+    int id = cpu_id();
+    int old = lock_depth[id];
+    lock_depth[id] = depth;
+    return old;
 }
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "cpu/smp.h"
+#include "cpu/apic.h"
+#include "cpu/cpu.h"
+#include "cpu/irq.h"
+#include "comm/cpu_instr.h"
+#include "core/memory.h"
+#include "core/task.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+#include "os_cfg.h"
+
+static int cpu_count = 1;
+static uint8_t cpu_apic_id[OS_CPU_MAX]; // 0号为BSP
+static volatile int ap_booting;         // 正在启动的AP的编号
+static volatile int ap_started;
+
+static int mp_checksum_ok(void *addr, int size)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < size; i++)
+        sum += ((uint8_t *)addr)[i];
+
+    return sum == 0;
+}
+
+static mp_float_t *mp_search_range(uint32_t start, int size)
+{
+    for (uint32_t addr = start; addr + sizeof(mp_float_t) <= start + size; addr += 16)
+    {
+        mp_float_t *mp = (mp_float_t *)addr;
+        if ((kernel_memcmp(mp->sig, "_MP_", 4) == 0) && mp_checksum_ok(mp, sizeof(mp_float_t)))
+            return mp;
+    }
+
+    return (mp_float_t *)0;
+}
+
+/**
+ * 按MP规范依次在EBDA的第1KB、基本内存的最后1KB、BIOS ROM中查找
+ */
+static mp_float_t *mp_search(void)
+{
+    mp_float_t *mp;
+
+    uint32_t ebda = *(uint16_t *)BDA_EBDA_SEG << 4;
+    if ((ebda >= MEM_EBDA_START) && (ebda < MEM_EBDA_END))
+    {
+        if ((mp = mp_search_range(ebda, 1024)) != (mp_float_t *)0)
+            return mp;
+    }
+
+    uint32_t base_end = *(uint16_t *)BDA_BASE_MEM_KB * 1024;
+    if ((base_end > MEM_EBDA_START) && (base_end <= MEM_EBDA_END))
+    {
+        if ((mp = mp_search_range(base_end - 1024, 1024)) != (mp_float_t *)0)
+            return mp;
+    }
+
+    return mp_search_range(MEM_BIOS_START, MEM_EXT_START - MEM_BIOS_START);
+}
+
+/**
+ * 从配置表中取出可用的处理器，BSP固定为0号，返回CPU数
+ */
+static int mp_parse(mp_config_t *config, int bsp_apic_id)
+{
+    int count = 1;
+    cpu_apic_id[0] = bsp_apic_id;
+
+    uint8_t *entry = (uint8_t *)(config + 1);
+    for (int i = 0; i < config->entry_count; i++)
+    {
+        if (*entry != MP_ENTRY_PROC)
+        {
+            entry += 8;
+            continue;
+        }
+
+        mp_proc_t *proc = (mp_proc_t *)entry;
+        entry += sizeof(mp_proc_t);
+        if (!(proc->flags & MP_PROC_ENABLED) || (proc->apic_id == bsp_apic_id))
+            continue;
+
+        if (count >= OS_CPU_MAX)
+        {
+            log_printf("smp: too many cpus, apic id %d ignored", proc->apic_id);
+            continue;
+        }
+
+        cpu_apic_id[count++] = proc->apic_id;
+    }
+
+    return count;
+}
+
+/**
+ * AP从启动代码进入这里，初始化后切换到自己的空闲任务，不再返回
+ */
+static void ap_main(void)
+{
+    int id = ap_booting;
+
+    cpu_init_ap(id);
+    irq_init_ap();
+    lapic_init_ap();
+
+    ap_started = 1;
+    task_idle_start();
+}
+
+/**
+ * @brief 查找MP表并逐个启动AP，没有MP表时只用BSP
+ */
+void smp_init(void)
+{
+    mp_float_t *mp = mp_search();
+    if ((mp == (mp_float_t *)0) || (mp->config == 0) || (mp->config >= MEM_LOWMEM_END))
+    {
+        log_printf("smp: no MP table, single cpu");
+        return;
+    }
+
+    mp_config_t *config = (mp_config_t *)mp->config;
+    if ((kernel_memcmp(config->sig, "PCMP", 4) != 0) || !mp_checksum_ok(config, config->length))
+    {
+        log_printf("smp: bad MP config table, single cpu");
+        return;
+    }
+
+    lapic_init(config->lapic_addr);
+    int count = mp_parse(config, lapic_id());
+    if (count == 1)
+        return;
+
+    // 启动代码在实模式下运行，复制到1MB以下，再填入保护模式及分页的参数
+    extern uint8_t ap_start[], ap_start_end[], ap_boot[];
+    kernel_memcpy((void *)SMP_AP_START, ap_start, ap_start_end - ap_start);
+
+    ap_boot_t *boot = (ap_boot_t *)(SMP_AP_START + (ap_boot - ap_start));
+    sgdt(&boot->gdt_limit);
+    boot->cr0 = read_cr0();
+    boot->cr3 = read_cr3();
+    boot->cr4 = read_cr4();
+    boot->entry = (uint32_t)ap_main;
+
+    // 部分BIOS收到INIT后按热启动处理，跳转到BDA中记录的地址
+    outb(CMOS_ADDR_PORT, CMOS_SHUTDOWN);
+    outb(CMOS_DATA_PORT, CMOS_SHUTDOWN_WARM);
+    *(uint16_t *)BDA_WARM_RESET = 0;
+    *(uint16_t *)(BDA_WARM_RESET + 2) = SMP_AP_START >> 4;
+
+    for (int i = 1; i < count; i++)
+    {
+        // 启动时的栈只用到切换至空闲任务为止
+        uint32_t stack = memory_alloc_page();
+        if (stack == 0)
+        {
+            log_printf("smp: no memory for cpu %d", i);
+            break;
+        }
+
+        task_idle_init(i);
+        boot->esp = stack + MEM_PAGE_SIZE;
+        ap_booting = i;
+        ap_started = 0;
+        cpu_count = i + 1;
+
+        lapic_start_ap(cpu_apic_id[i], SMP_AP_START);
+        for (int ms = 0; (ms < 100) && !ap_started; ms++)
+            lapic_udelay(1000);
+
+        if (!ap_started)
+        {
+            log_printf("smp: cpu %d not responding, apic id %d", i, cpu_apic_id[i]);
+            cpu_count = i;
+            break;
+        }
+
+        log_printf("smp: cpu %d started, apic id %d", i, cpu_apic_id[i]);
+    }
+
+    outb(CMOS_ADDR_PORT, CMOS_SHUTDOWN);
+    outb(CMOS_DATA_PORT, 0);
+    log_printf("smp: %d cpus online", cpu_count);
+}
+
+int smp_cpu_count(void)
+{
+    return cpu_count;
+}
+
+/**
+ * @brief 通知其它CPU重新调度
+ */
+void smp_send_resched(int cpu)
+{
+    if ((cpu >= cpu_count) || (cpu == cpu_id()))
+        return;
+
+    irq_state_t state = irq_enter_protection();
+    lapic_send_ipi(cpu_apic_id[cpu], IRQ_RESCHED);
+    irq_leave_protection(state);
+}
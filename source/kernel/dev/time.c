@@ -4,19 +4,202 @@
 #include "os_cfg.h"
 #include "cpu/irq.h"
 #include "core/task.h"
+#include "cpu/cpu.h"
+#include "core/memory.h"
 
-static uint32_t sys_tick;
+static uint32_t sys_ms; // 启动后经过的毫秒数
+
+#if OS_TICKLESS
+static uint32_t ms_frac;    // 不足1ms的部分，单位为 计数周期*1000
+static uint32_t tick_count; // 每个tick装入的计数值
+static uint32_t pit_count;  // 最近一次装入的计数值
+static uint32_t pit_passed; // 本次计数中已计入时钟的周期数
+static uint32_t idle_ms;    // 空闲时走过但尚未交给睡眠队列的毫秒数
+static int idle_oneshot;    // 空闲时装入了更长的单次定时
+#endif
+
+/**
+ * 将系统时钟同步到用户可读的数据页
+ */
+static void time_sync_vdata(void)
+{
+    vdata_t *vdata = memory_vdata();
+    vdata->ms = sys_ms;
+    vdata->ticks = sys_ms / OS_TICK_MS;
+}
 
 uint32_t sys_get_ticks (void) {
-    return sys_tick;
+    return sys_ms / OS_TICK_MS;
+}
+
+uint32_t sys_get_ms(void)
+{
+    return sys_ms;
+}
+
+/**
+ * 没有就绪任务时停机，停机前释放内核锁，其它CPU才能进入内核
+ * 开中断与停机之间不会响应中断，唤醒不会丢失
+ */
+static void time_idle_halt(void)
+{
+    irq_unlock_kernel();
+    sti_hlt();
+    irq_lock_kernel();
+}
+
+/**
+ * 不改变定时，停机等待下一个中断，有可运行的任务时直接调度
+ */
+static void time_idle_wait(void)
+{
+    irq_state_t state = irq_enter_protection();
+
+    if (task_has_ready())
+        task_dispatch();
+    else
+        time_idle_halt();
+
+    irq_leave_protection(state);
+}
+
+#if OS_TICKLESS
+static uint32_t time_advance(uint32_t cycles)
+{
+    ms_frac += cycles * 1000;
+    uint32_t ms = ms_frac / PIT_OSC_FREQ;
+    ms_frac %= PIT_OSC_FREQ;
+    sys_ms += ms;
+    time_sync_vdata();
+    return ms;
+}
+
+static void pit_load(uint32_t count)
+{
+    outb(PIT_COMMAND_MODE_PORT, PIT_CHANNLE0 | PIT_LOAD_LOHI | PIT_MODE0);
+    outb(PIT_CHANNEL0_DATA_PORT, count & 0xFF);
+    outb(PIT_CHANNEL0_DATA_PORT, (count >> 8) & 0xFF);
+
+    pit_count = count;
+    pit_passed = 0;
+}
+
+/**
+ * 装入后经过的周期数，计到0后OUT变高，计数器从0xFFFF继续往下计
+ */
+static uint32_t pit_elapsed(void)
+{
+    outb(PIT_COMMAND_MODE_PORT, PIT_READ_BACK | PIT_RB_CHANNEL0);
+    uint8_t status = inb(PIT_CHANNEL0_DATA_PORT);
+    uint32_t count = inb(PIT_CHANNEL0_DATA_PORT);
+    count |= inb(PIT_CHANNEL0_DATA_PORT) << 8;
+
+    if (status & PIT_STATUS_NULL)
+        return 0;
+    if (status & PIT_STATUS_OUT)
+        return pit_count + ((0x10000 - count) & 0xFFFF);
+    return pit_count - count;
+}
+
+/**
+ * 将计数器已走过的时间计入系统时钟，返回新增的毫秒数
+ */
+static uint32_t time_update(void)
+{
+    uint32_t elapsed = pit_elapsed();
+    uint32_t ms = time_advance(elapsed - pit_passed);
+    pit_passed = elapsed;
+    return ms;
+}
+
+void do_handler_time(exception_frame_t *frame)
+{
+    // 按实际走过的时间计，空闲时的单次定时可能远超过一个tick
+    uint32_t ms = idle_ms + time_update();
+    idle_ms = 0;
+    idle_oneshot = 0;
+    pit_load(tick_count);
+
+    pic_send_eoi(IRQ0_TIMER);
+    task_time_tick(ms);
+}
+
+/**
+ * @brief 空闲任务调用：没有就绪任务时，按最早到期的睡眠任务装入单次定时后停机
+ */
+void time_idle(void)
+{
+    // PIT只连到BSP，其它CPU等待本地定时器或处理器间中断
+    if (cpu_id() != 0)
+    {
+        time_idle_wait();
+        return;
+    }
+
+    irq_state_t state = irq_enter_protection();
+
+    // 先将已走过的时间交给睡眠队列，可能有任务就此到期
+    task_sleep_advance(idle_ms + time_update());
+    idle_ms = 0;
+    if (task_has_ready())
+    {
+        task_dispatch();
+        irq_leave_protection(state);
+        return;
+    }
+
+    // 没有睡眠任务或超出计数范围时，装入最大值，到期后再重新计算
+    uint32_t count = PIT_COUNT_MAX;
+    int remain = task_sleep_remain();
+    if ((remain > 0) && (remain < PIT_COUNT_MAX * 1000 / PIT_OSC_FREQ))
+        count = remain * PIT_OSC_FREQ / 1000;
+
+    pit_load(count);
+    idle_oneshot = 1;
+    time_idle_halt();
+
+    irq_leave_protection(state);
+}
+
+/**
+ * @brief 被定时器以外的中断唤醒并切换到其它任务时，恢复每个tick的定时
+ * 已走过的时间留到下个tick交给睡眠队列，单次定时已到期时，挂起的定时器中断随后就会到来
+ */
+void time_idle_exit(void)
+{
+    if (!idle_oneshot || (cpu_id() != 0))
+        return;
+
+    idle_ms += time_update();
+    idle_oneshot = 0;
+    pit_load(tick_count);
 }
 
+static void init_pit(void)
+{
+    tick_count = PIT_OSC_FREQ * OS_TICK_MS / 1000;
+    pit_load(tick_count);
+
+    irq_install(IRQ0_TIMER, (irq_handler_t)exception_handler_time);
+    irq_enable(IRQ0_TIMER);
+}
+#else
 void do_handler_time(exception_frame_t *frame)
 {
-    sys_tick++;
+    sys_ms += OS_TICK_MS;
+    time_sync_vdata();
 
     pic_send_eoi(IRQ0_TIMER);
-    task_time_tick();
+    task_time_tick(OS_TICK_MS);
+}
+
+void time_idle(void)
+{
+    time_idle_wait();
+}
+
+void time_idle_exit(void)
+{
 }
 
 static void init_pit(void)
@@ -29,9 +212,11 @@ static void init_pit(void)
     irq_install(IRQ0_TIMER, (irq_handler_t)exception_handler_time);
     irq_enable(IRQ0_TIMER);
 }
+#endif
 
 void time_init(void)
 {
-    sys_tick = 0;
+    sys_ms = 0;
+    time_sync_vdata();
     init_pit();
-}
\ No newline at end of file
+}
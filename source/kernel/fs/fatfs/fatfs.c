@@ -561,7 +561,10 @@ int fatfs_write(char *buf, int size, file_t *file)
         buf += curr_write;
         nbytes -= curr_write;
         total_write += curr_write;
-        file->size += curr_write;
+
+        // 覆盖已有内容时文件大小不变
+        if (file->pos + curr_write > file->size)
+            file->size = file->pos + curr_write;
 
         int err = move_file_pos(file, fat, curr_write, 1);
 
@@ -628,7 +631,9 @@ int fatfs_seek(file_t *file, uint32_t offset, int dir)
 
 int fatfs_stat(file_t *file, struct stat *st)
 {
-    return -1;
+    st->st_size = file->size;
+    st->st_mode = (file->type == FILE_DIR) ? S_IFDIR : S_IFREG;
+    return 0;
 }
 
 int fatfs_opendir(struct _fs_t *fs, const char *name, DIR *dir)
@@ -1,53 +1,53 @@
 #include "fs/file.h"
-#include "ipc/mutex.h"
+#include "core/kmem.h"
+#include "cpu/irq.h"
+#include "ipc/spinlock.h"
 #include "tools/klib.h"
 
-static file_t file_table[FILE_TABLE_SIZE];
-static mutex_t file_alloc_mutex;
+static kmem_cache_t file_cache;
+static spinlock_t file_lock; // 保护文件的引用计数，不依赖内核锁
 
 file_t *file_alloc(void)
 {
-    file_t *file = (file_t *)0;
-
-    mutex_lock(&file_alloc_mutex);
-    for (int i = 0; i < FILE_TABLE_SIZE; i++)
+    file_t *file = (file_t *)kmem_cache_alloc(&file_cache);
+    if (file)
     {
-        file_t *p_file = file_table + i;
-        if (p_file->ref == 0)
-        {
-            kernel_memset(p_file, 0, sizeof(file_t));
-            p_file->ref = 1;
-            file = p_file;
-            break;
-        }
+        kernel_memset(file, 0, sizeof(file_t));
+        file->ref = 1;
     }
 
-    mutex_unlock(&file_alloc_mutex);
-
     return file;
 }
 
+/**
+ * @brief 释放文件结构，由最后一个引用者调用
+ */
 void file_free(file_t *file)
 {
-    mutex_lock(&file_alloc_mutex);
-
-    if (file->ref)
-    {
-        file->ref--;
-    }
-
-    mutex_unlock(&file_alloc_mutex);
+    kmem_cache_free(&file_cache, file);
 }
 
 void file_table_init(void)
 {
-    mutex_init(&file_alloc_mutex);
-    kernel_memset(file_table, 0, sizeof(file_table));
+    kmem_cache_init(&file_cache, "file", sizeof(file_t), 0);
+    spin_init(&file_lock);
 }
 
 void file_inc_ref(file_t *file)
 {
-    mutex_lock(&file_alloc_mutex);
+    irq_state_t state = spin_lock_irqsave(&file_lock);
     file->ref++;
-    mutex_unlock(&file_alloc_mutex);
-}
\ No newline at end of file
+    spin_unlock_irqrestore(&file_lock, state);
+}
+
+/**
+ * @brief 减少一次引用，返回剩余的引用数，为0时由调用者关闭并释放
+ */
+int file_dec_ref(file_t *file)
+{
+    irq_state_t state = spin_lock_irqsave(&file_lock);
+    ASSERT(file->ref > 0);
+    int ref = --file->ref;
+    spin_unlock_irqrestore(&file_lock, state);
+    return ref;
+}
@@ -12,6 +12,8 @@
 #include <sys/file.h>
 #include "dev/disk.h"
 #include "os_cfg.h"
+#include "core/memory.h"
+#include "core/image.h"
 
 #define FS_TABLE_SIZE 10
 static list_t mounted_list;
@@ -190,6 +192,9 @@ int sys_read(int file, char *ptr, int len)
         return -1;
     }
 
+    if (memory_fault_in((uint32_t)ptr, len) < 0)
+        return -1;
+
     fs_t *fs = p_file->fs;
     fs_protect(fs);
     int err = fs->op->read(ptr, len, p_file);
@@ -213,11 +218,17 @@ int sys_write(int file, char *ptr, int len)
         return -1;
     }
 
+    if (memory_fault_in((uint32_t)ptr, len) < 0)
+        return -1;
+
     fs_t *fs = p_file->fs;
     fs_protect(fs);
     int err = fs->op->write(ptr, len, p_file);
     fs_leave_protect(fs);
 
+    // 程序文件被改写后，缓存的代码页不再有效
+    if (p_file->type == FILE_NORMAL)
+        image_invalidate(p_file);
     return err;
 }
 
@@ -256,21 +267,71 @@ int sys_close(int file)
         return -1;
     }
 
-    ASSERT(p_file->ref > 0);
+    fs_close_file(p_file);
+    task_remove_fd(file);
+
+    return 0;
+}
 
-    if (p_file->ref-- == 1)
+/**
+ * @brief 释放对文件的一次引用，最后一次引用时关闭文件
+ */
+void fs_close_file(file_t *file)
+{
+    if (file_dec_ref(file) == 0)
     {
-        fs_t *fs = p_file->fs;
+        fs_t *fs = file->fs;
         fs_protect(fs);
-        fs->op->close(p_file);
+        fs->op->close(file);
         fs_leave_protect(fs);
 
-        file_free(p_file);
+        file_free(file);
     }
+}
 
-    task_remove_fd(file);
+/**
+ * @brief 从文件的指定位置读取，不经过进程的文件描述符
+ */
+int fs_read_file(file_t *file, uint32_t offset, char *buf, int size)
+{
+    fs_t *fs = file->fs;
+    fs_protect(fs);
 
-    return 0;
+    // 文件可能同时被进程通过描述符访问，读完后恢复原位置
+    int pos = file->pos, cblk = file->cblk;
+    int err = fs->op->seek(file, offset, 0);
+    if (err >= 0)
+        err = fs->op->read(buf, size, file);
+    file->pos = pos;
+    file->cblk = cblk;
+
+    fs_leave_protect(fs);
+
+    if (file->type == FILE_NORMAL)
+        image_invalidate(file);
+    return err;
+}
+
+/**
+ * @brief 写入文件的指定位置，不经过进程的文件描述符
+ */
+int fs_write_file(file_t *file, uint32_t offset, char *buf, int size)
+{
+    fs_t *fs = file->fs;
+    fs_protect(fs);
+
+    int pos = file->pos, cblk = file->cblk;
+    int err = fs->op->seek(file, offset, 0);
+    if (err >= 0)
+        err = fs->op->write(buf, size, file);
+    file->pos = pos;
+    file->cblk = cblk;
+
+    fs_leave_protect(fs);
+
+    if (file->type == FILE_NORMAL)
+        image_invalidate(file);
+    return err;
 }
 
 int sys_isatty(int file)
@@ -327,7 +388,7 @@ int sys_dup(int file)
     int fd = task_alloc_fd(p_file);
     if (fd >= 0)
     {
-        p_file->ref++;
+        file_inc_ref(p_file);
         return fd;
     }
 
@@ -0,0 +1,321 @@
+#include "fs/ring.h"
+#include "fs/fs.h"
+#include "core/kmem.h"
+#include "core/memory.h"
+#include "cpu/irq.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+
+static void ring_wake(ring_worker_t *worker)
+{
+    if (worker->waiting)
+    {
+        worker->waiting = 0;
+        sem_notify(&worker->wait_sem);
+    }
+}
+
+/**
+ * 进程等待线程的进展，调用者在返回后重新检查等待的条件
+ */
+static void ring_wait(ring_worker_t *worker)
+{
+    worker->waiting = 1;
+    sem_wait(&worker->wait_sem);
+}
+
+/**
+ * 逐页检查路径，直到结尾的0
+ */
+static int ring_check_path(uint32_t path, int prepare)
+{
+    for (uint32_t addr = path; addr < path + RING_PATH_MAX; addr++)
+    {
+        if ((addr == path) || !(addr & (MEM_PAGE_SIZE - 1)))
+        {
+            int err = prepare ? memory_user_prepare(addr, 1, 0) : memory_user_check(addr, 1, 0);
+            if (err < 0)
+                return -1;
+        }
+
+        if (*(char *)addr == '\0')
+            return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * 检查一项操作用到的用户内存，prepare时先在进程的上下文中调入
+ */
+static int ring_check_sqe(ring_sqe_t *sqe, int prepare)
+{
+    uint32_t addr = (uint32_t)sqe->addr;
+
+    switch (sqe->opcode)
+    {
+    case RING_OP_READ:
+    case RING_OP_WRITE:
+    {
+        if (sqe->len < 0)
+            return -1;
+
+        // 读文件时写入缓冲区
+        int write = (sqe->opcode == RING_OP_READ);
+        return prepare ? memory_user_prepare(addr, sqe->len, write)
+                       : memory_user_check(addr, sqe->len, write);
+    }
+    case RING_OP_OPEN:
+        return ring_check_path(addr, prepare);
+    default:
+        return 0;
+    }
+}
+
+static int ring_do_op(ring_sqe_t *sqe)
+{
+    if (ring_check_sqe(sqe, 0) < 0)
+        return -1;
+
+    switch (sqe->opcode)
+    {
+    case RING_OP_NOP:
+        return 0;
+    case RING_OP_READ:
+        return sys_read(sqe->fd, (char *)sqe->addr, sqe->len);
+    case RING_OP_WRITE:
+        return sys_write(sqe->fd, (char *)sqe->addr, sqe->len);
+    case RING_OP_OPEN:
+        return sys_open((const char *)sqe->addr, sqe->flags);
+    case RING_OP_CLOSE:
+        return sys_close(sqe->fd);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * 依次执行已提交的项，完成队列满或进程暂停时停下
+ */
+static void ring_run(ring_worker_t *worker)
+{
+    ring_t *ring = worker->ring;
+
+    while (!worker->stop && !worker->paused && (worker->sq_head != worker->sq_limit))
+    {
+        ring_sqe_t *sqe = worker->sqes + (worker->sq_head & (worker->entries - 1));
+
+        // 用户在cq_tail增加后就会读取，完成项须先写入
+        volatile ring_cqe_t *cqe = worker->cqes + (worker->cq_tail & (worker->entries - 1));
+
+        // 进程可能已解除了队列的映射，每次访问前都要检查。不可访问时丢弃剩余的项
+        if ((memory_user_check((uint32_t)ring, sizeof(ring_t), 1) < 0) ||
+            (memory_user_check((uint32_t)sqe, sizeof(ring_sqe_t), 0) < 0) ||
+            (memory_user_check((uint32_t)cqe, sizeof(ring_cqe_t), 1) < 0))
+        {
+            log_printf("ring: queue not accessible.");
+            worker->sq_limit = worker->sq_head;
+            break;
+        }
+
+        if (worker->cq_tail - ring->cq_head >= worker->entries)
+            break;
+
+        // 复制一份，执行期间用户修改队列不影响本项。执行中阻塞时进程不会修改地址空间
+        worker->running = 1;
+        ring_sqe_t copy = *sqe;
+        int res = ring_do_op(&copy);
+
+        cqe->user_data = copy.user_data;
+        cqe->res = res;
+        ring->sq_head = ++worker->sq_head;
+        ring->cq_tail = ++worker->cq_tail;
+        worker->running = 0;
+
+        ring_wake(worker);
+    }
+
+    ring_wake(worker);
+}
+
+static void ring_worker_entry(void)
+{
+    ring_worker_t *worker = (ring_worker_t *)task_current();
+
+    // 与系统调用一样持有内核锁执行，阻塞时随任务切换释放
+    irq_lock_kernel();
+
+    while (!worker->stop)
+    {
+        ring_run(worker);
+        if (!worker->stop)
+            sem_wait(&worker->submit_sem);
+    }
+
+    // 先移出就绪队列再通知进程，进程回收时线程已不会再运行
+    irq_enter_protection();
+    worker->task.state = TASK_ZOMBIE;
+    task_set_block(&worker->task);
+    ring_wake(worker);
+    task_dispatch();
+}
+
+/**
+ * @brief 注册进程的队列，创建代其执行操作的内核线程
+ * 每个进程只能有一个队列
+ */
+int sys_ring_setup(ring_t *ring)
+{
+    task_t *task = task_current();
+    if (task->ring)
+    {
+        log_printf("ring: already set up.");
+        return -1;
+    }
+
+    if (memory_user_prepare((uint32_t)ring, sizeof(ring_t), 1) < 0)
+        return -1;
+
+    uint32_t entries = ring->entries;
+    if ((entries == 0) || (entries > RING_ENTRIES_MAX) || (entries & (entries - 1)))
+    {
+        log_printf("ring: bad entries %d", entries);
+        return -1;
+    }
+
+    if ((memory_user_prepare((uint32_t)ring->sqes, entries * sizeof(ring_sqe_t), 0) < 0) ||
+        (memory_user_prepare((uint32_t)ring->cqes, entries * sizeof(ring_cqe_t), 1) < 0))
+    {
+        log_printf("ring: bad queue address.");
+        return -1;
+    }
+
+    ring_worker_t *worker = (ring_worker_t *)kmalloc(sizeof(ring_worker_t));
+    if (worker == (ring_worker_t *)0)
+    {
+        log_printf("ring: no memory.");
+        return -1;
+    }
+
+    kernel_memset(worker, 0, sizeof(ring_worker_t));
+    worker->ring = ring;
+    worker->entries = entries;
+    worker->sqes = ring->sqes;
+    worker->cqes = ring->cqes;
+    worker->sq_head = worker->sq_limit = ring->sq_head;
+    worker->cq_tail = ring->cq_tail;
+    sem_init(&worker->submit_sem, 0);
+    sem_init(&worker->wait_sem, 0);
+
+    int err = task_init(&worker->task, "ring worker", TASK_FLAGS_SYSTEM, (uint32_t)ring_worker_entry,
+                        (uint32_t)worker->stack + sizeof(worker->stack));
+    if (err < 0)
+    {
+        task_uninit(&worker->task);
+        kfree(worker);
+        return -1;
+    }
+
+    worker->task.owner = task;
+    task_set_priority(&worker->task, task->prio);
+    task->ring = worker;
+    task_start(&worker->task);
+    return 0;
+}
+
+/**
+ * @brief 提交to_submit项，min_complete大于0时等到完成队列中至少有这么多项
+ * 队列和缓冲区在这里调入，线程执行时只做检查，不会修改进程的页表
+ * @return 提交的项数
+ */
+int sys_ring_enter(ring_t *ring, int to_submit, int min_complete)
+{
+    ring_worker_t *worker = task_current()->ring;
+    if ((worker == (ring_worker_t *)0) || (ring != worker->ring))
+        return -1;
+
+    uint32_t entries = worker->entries;
+    if ((memory_user_prepare((uint32_t)ring, sizeof(ring_t), 1) < 0) ||
+        (memory_user_prepare((uint32_t)worker->sqes, entries * sizeof(ring_sqe_t), 0) < 0) ||
+        (memory_user_prepare((uint32_t)worker->cqes, entries * sizeof(ring_cqe_t), 1) < 0))
+    {
+        return -1;
+    }
+
+    // 不超过用户已填好的项，队列中未执行的项不超过队列大小
+    uint32_t count = (to_submit > 0) ? to_submit : 0;
+    uint32_t filled = ring->sq_tail - worker->sq_limit;
+    uint32_t space = entries - (worker->sq_limit - worker->sq_head);
+    if (count > filled)
+        count = filled;
+    if (count > space)
+        count = space;
+
+    // 调入失败的项由线程执行时检查，结果为-1
+    for (uint32_t i = 0; i < count; i++)
+        ring_check_sqe(worker->sqes + ((worker->sq_limit + i) & (entries - 1)), 1);
+
+    if (count > 0)
+    {
+        worker->sq_limit += count;
+        sem_notify(&worker->submit_sem);
+    }
+
+    if (min_complete > (int)entries)
+        min_complete = entries;
+
+    while ((min_complete > 0) && (worker->sq_head != worker->sq_limit) &&
+           (worker->cq_tail - ring->cq_head < (uint32_t)min_complete))
+    {
+        ring_wait(worker);
+    }
+
+    return count;
+}
+
+int sys_ring_release(void)
+{
+    ring_release(task_current());
+    return 0;
+}
+
+/**
+ * @brief 停止并回收进程的队列线程，进程退出或替换地址空间前调用
+ * 正在执行的操作完成后才返回，如读终端时会等到有输入
+ */
+void ring_release(task_t *task)
+{
+    ring_worker_t *worker = task->ring;
+    if (worker == (ring_worker_t *)0)
+        return;
+
+    worker->stop = 1;
+    sem_notify(&worker->submit_sem);
+    while (worker->task.state != TASK_ZOMBIE)
+        ring_wait(worker);
+
+    task->ring = (ring_worker_t *)0;
+    task_uninit(&worker->task);
+    kfree(worker);
+}
+
+/**
+ * @brief 进程解除映射等修改页表前调用，等正在执行的操作完成，之后不开始新的操作
+ */
+void ring_pause(task_t *task)
+{
+    ring_worker_t *worker = task->ring;
+    if (worker == (ring_worker_t *)0)
+        return;
+
+    worker->paused++;
+    while (worker->running)
+        ring_wait(worker);
+}
+
+void ring_resume(task_t *task)
+{
+    ring_worker_t *worker = task->ring;
+    if (worker && (--worker->paused == 0))
+        sem_notify(&worker->submit_sem);
+}
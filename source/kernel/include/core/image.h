@@ -0,0 +1,47 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "comm/types.h"
+#include "tools/list.h"
+#include "fs/file.h"
+
+#define IMAGE_CACHE_NR 16 // 缓存中最多保留的程序映像数
+
+/**
+ * 程序映像，以文件所在的文件系统、起始簇及大小标识同一文件
+ * 运行同一程序的进程共享其中只读段的物理页
+ */
+typedef struct _image_t
+{
+    struct _fs_t *fs;
+    int sblk;
+    uint32_t size;
+
+    int ref; // 缓存及各进程的区域各持有一个引用
+    list_node_t node;
+
+    int page_count;               // 按文件大小计算的页数
+    struct _image_page_t *pages; // 已装入的页，按所在文件页的序号索引
+} image_t;
+
+/**
+ * 映像中已装入的页，vaddr为0表示未装入
+ * 同一文件页可能被映射到不同的虚拟页，只缓存先装入的那个
+ */
+typedef struct _image_page_t
+{
+    uint32_t vaddr;
+    uint32_t paddr;
+} image_page_t;
+
+void image_init(void);
+
+image_t *image_get(file_t *file);
+void image_inc_ref(image_t *image);
+void image_put(image_t *image);
+
+uint32_t image_find_page(image_t *image, uint32_t offset, uint32_t vaddr);
+uint32_t image_add_page(image_t *image, uint32_t offset, uint32_t vaddr, uint32_t paddr);
+void image_invalidate(file_t *file);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef KMEM_H
+#define KMEM_H
+
+#include "comm/types.h"
+#include "tools/list.h"
+
+#define KMEM_NAME_SIZE 16
+#define KMEM_MIN_SIZE 16   // kmalloc最小的对象大小
+#define KMEM_SIZE_NR 8     // kmalloc的大小级别: 16, 32 ... 2048
+
+/**
+ * 对象缓存，同一类型的对象从若干个slab页中分配
+ */
+typedef struct _kmem_cache_t
+{
+    char name[KMEM_NAME_SIZE];
+    int obj_size;
+    int obj_per_slab;
+    void (*ctor)(void *obj); // 新slab中的对象在首次使用前调用
+
+    list_t partial_list; // 部分空闲的slab
+    list_t full_list;    // 已分配完的slab
+    list_t free_list;    // 完全空闲的slab，最多保留一个
+
+    int obj_count; // 已分配出去的对象数
+    int slab_count;
+    list_node_t node;
+} kmem_cache_t;
+
+/**
+ * slab页头，位于每个slab页的起始处
+ * 大块分配(kmalloc超过最大级别)时同样放在开头，cache为0
+ */
+typedef struct _kmem_slab_t
+{
+    list_node_t node;
+    kmem_cache_t *cache;
+    void *free_obj; // 空闲对象单链表
+    int inuse;      // 大块分配时为页数
+} kmem_slab_t;
+
+void kmem_init(void);
+
+int kmem_cache_init(kmem_cache_t *cache, const char *name, int obj_size, void (*ctor)(void *obj));
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+void *kmalloc(int size);
+void kfree(void *ptr);
+
+int kmem_page_count(void);
+
+#endif
@@ -2,27 +2,76 @@
 #define MEMORY_H
 
 #include "comm/types.h"
-#include "tools/bitmap.h"
 #include "ipc/mutex.h"
+#include "ipc/spinlock.h"
 #include "comm/boot_info.h"
+#include "tools/list.h"
+#include "fs/file.h"
+#include "os_cfg.h"
+#include "core/syscall.h"
+#include "comm/vdata.h"
 
 #define MEM_EXT_START (1024 * 1024)
-#define MEM_EXT_END (127 * 1024 * 1024)
 #define MEM_PAGE_SIZE 4096
+#define MEM_LARGE_PAGE_SIZE (4 * 1024 * 1024)
 #define MEM_EBDA_START 0x80000
+#define MEM_EBDA_END 0xA0000
+#define MEM_BIOS_START 0xF0000 // BIOS ROM，其中可能有MP表
 #define MEMORY_TASK_BASE 0x80000000
 
+#define MEM_KMAP_BASE (MEMORY_TASK_BASE - MEM_LARGE_PAGE_SIZE) // 临时映射窗口，内核经此访问高端内存中的页
+#define MEM_KMAP_NR (MEM_LARGE_PAGE_SIZE / MEM_PAGE_SIZE)
+#define MEM_FIXMAP_NR 1 // 窗口顶部固定映射的页，用于访问设备寄存器
+#define MEM_FIXMAP_LAPIC 0
+#define MEM_KMAP_COPY_SIZE 256 // 两个高端内存页之间经栈上缓冲分段复制，每段的大小
+#define MEM_LOWMEM_END MEM_KMAP_BASE // 此下的物理内存与内核地址一一对应，此上为高端内存，只用作用户页
+
 #define MEM_TASK_STACK_TOP 0xE0000000
 #define MEM_TASK_STACK_SIZE (MEM_PAGE_SIZE * 500)
 #define MEM_TASK_ARG_SIZE (MEM_PAGE_SIZE * 4)
+#define MEM_TASK_STACK_GUARD_SIZE MEM_PAGE_SIZE // 栈底不映射的保护页
+#define MEM_TASK_MMAP_TOP (MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE) // mmap从栈的下方向下分配
+
+#define MEM_ZERO_POOL_LOW 16  // 预清零页少于此数时，空闲任务开始补充
+#define MEM_ZERO_POOL_HIGH 64 // 补充到此数为止
+
+#define MEM_BUDDY_ORDER_NR 11 // 伙伴系统最大块为2^10页，即4MB
+
+#define MEM_PAGE_FREE (1 << 0)
+
+/**
+ * 物理页描述结构
+ */
+typedef struct _mem_page_t
+{
+    list_node_t node; // 空闲时挂在对应阶的空闲链表中
+    uint16_t ref;     // 引用计数，用于写时复制
+    uint8_t order;    // 空闲块的阶，仅块的首页有效
+    uint8_t flags;
+} mem_page_t;
+
+/**
+ * 预清零页池的状态，用于调整水位
+ */
+typedef struct _mem_zero_info_t
+{
+    int count;       // 池中的页数
+    int low_mark;
+    int high_mark;
+    uint32_t hit;    // 分配时池中有页
+    uint32_t miss;   // 分配时池为空，只能当场清零
+    uint32_t refill; // 空闲任务累计清零的页数
+} mem_zero_info_t;
 
 typedef struct _addr_alloc_t
 {
-    mutex_t mutex;
-    bitmap_t bitmap;
+    mem_page_t *pages;
+    list_t free_list[MEM_BUDDY_ORDER_NR];
+    int free_count;
     uint32_t start;
     uint32_t size;
     uint32_t page_size;
+    spinlock_t lock; // 只保护空闲链表和页的引用计数，不依赖内核锁
 } addr_alloc_t;
 
 typedef struct _memory_map_t
@@ -33,28 +82,108 @@ typedef struct _memory_map_t
     uint32_t perm;
 } memory_map_t;
 
+typedef enum _mem_region_type_t
+{
+    MEM_REGION_ANON, // 首次访问时分配清零的页
+    MEM_REGION_FILE, // 首次访问时从文件中读取
+} mem_region_type_t;
+
+#define MEM_REGION_HEAP (1 << 0)
+#define MEM_REGION_STACK (1 << 1)
+#define MEM_REGION_MMAP (1 << 2)   // 由mmap创建，可被munmap解除
+#define MEM_REGION_SHARED (1 << 3) // 共享映射，fork后父子进程共享物理页
+#define MEM_REGION_SHM (1 << 4)    // 共享内存段的映射
+
+/**
+ * 进程地址空间中的一段虚拟区域，页面在缺页时才分配
+ */
+typedef struct _mem_region_t
+{
+    uint32_t start;
+    uint32_t end;
+    uint32_t perm;
+    mem_region_type_t type;
+    int flags;
+
+    // 文件内容[file_offset, file_offset + file_size)对应虚拟地址file_vaddr开始处
+    file_t *file;
+    uint32_t file_offset;
+    uint32_t file_vaddr;
+    uint32_t file_size;
+    struct _image_t *image; // 只读的程序段，页在运行同一程序的进程间共享
+
+    list_node_t node;
+} mem_region_t;
+
 void memory_init(boot_info_t *boot_info);
 
 uint32_t memory_create_uvm(void);
+uint32_t memory_kernel_page_dir(void);
+vdata_t *memory_vdata(void);
+void memory_vdata_set_pid(uint32_t page_dir, int pid);
 
 int memory_alloc_page_for(uint32_t addr, uint32_t size, int perm);
 uint32_t memory_alloc_for_page_dir(uint32_t page_dir, uint32_t vaddr, uint32_t size, int perm);
 
 uint32_t memory_alloc_page(void);
+uint32_t memory_alloc_pages(int page_count);
+void memory_free_pages(uint32_t addr, int page_count);
 
 void memory_free_page(uint32_t addr);
+void memory_put_page(uint32_t paddr);
+
+void *memory_kmap(uint32_t paddr);
+void memory_kunmap(void *vaddr);
+void *memory_fixmap(int index, uint32_t paddr);
+
+uint32_t memory_alloc_zero_page(void);
+int memory_zero_pool_refill(void);
+void memory_zero_pool_info(mem_zero_info_t *info);
+void memory_zero_pool_set_mark(int low_mark, int high_mark);
 
 void memory_destroy_uvm(uint32_t page_dir);
+void memory_free_page_dir(uint32_t page_dir);
 
 uint32_t memory_copy_uvm(uint32_t page_dir);
 
 uint32_t memory_get_paddr(uint32_t page_dir, uint32_t vaddr);
+uint32_t memory_user_paddr(uint32_t vaddr);
+int memory_user_check(uint32_t vaddr, uint32_t size, int write);
+int memory_user_prepare(uint32_t vaddr, uint32_t size, int write);
 
 int memory_copy_uvm_data(uint32_t to,
                          uint32_t page_dir,
                          uint32_t from,
                          uint32_t size);
 
+mem_region_t *memory_add_region(list_t *region_list, uint32_t start,
+                                uint32_t end, uint32_t perm);
+mem_region_t *memory_add_file_region(list_t *region_list, uint32_t vaddr,
+                                     uint32_t mem_size, uint32_t perm, file_t *file,
+                                     uint32_t offset, uint32_t file_size);
+mem_region_t *memory_find_region(list_t *region_list, uint32_t vaddr);
+int memory_copy_regions(list_t *to, list_t *from);
+void memory_free_regions(list_t *region_list);
+
+int memory_fault_in(uint32_t vaddr, uint32_t size);
+int memory_fault_in_shared(list_t *region_list);
+void memory_sync_regions(list_t *region_list, uint32_t page_dir);
+int memory_handle_page_fault(uint32_t vaddr, int err_code);
+
 char *sys_sbrk(int incr);
+uint32_t memory_map_pages(uint32_t vaddr, uint32_t *pages, int page_count, uint32_t perm, int flags);
+int memory_unmap_region(uint32_t vaddr, int flags);
+
+int sys_mmap(mmap_args_t *args);
+int sys_munmap(uint32_t addr, uint32_t length);
+int sys_madvise(uint32_t addr, uint32_t length, int advice);
+
+uint32_t memory_count_rss(uint32_t page_dir);
+void memory_get_stat(mem_stat_t *stat);
+int sys_meminfo(mem_stat_t *stat);
+
+#if OS_BENCH
+void memory_bench(void);
+#endif
 
 #endif
\ No newline at end of file
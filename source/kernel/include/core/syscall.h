@@ -8,6 +8,8 @@
 #define SYS_fork 2
 #define SYS_execve 3
 #define SYS_yield 4
+#define SYS_spawn 5
+#define SYS_vfork 6
 
 #define SYS_open 50
 #define SYS_read 51
@@ -25,10 +27,161 @@
 #define SYS_closedir 63
 #define SYS_ioctl 64
 #define SYS_unlink 65
+#define SYS_mmap 66
+#define SYS_munmap 67
+#define SYS_shmget 68
+#define SYS_shmat 69
+#define SYS_shmdt 70
+#define SYS_shmctl 71
+#define SYS_madvise 72
+#define SYS_meminfo 73
+#define SYS_taskinfo 74
+#define SYS_setpriority 75
+#define SYS_getpriority 76
+#define SYS_ring_enter 77
+#define SYS_futex_wait 78
+#define SYS_futex_wake 79
+#define SYS_ring_setup 80
+#define SYS_ring_release 81
 
 #define SYS_printmsg 100
 
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+#define MAP_SHARED 0x01    // 与fork出的父子进程共享页，文件映射在解除映射时写回
+#define MAP_PRIVATE 0x02   // 写入时复制，不影响文件
+#define MAP_FIXED 0x10     // 必须映射到指定地址
+#define MAP_ANONYMOUS 0x20 // 不关联文件，内容为0
+
+#define MAP_FAILED ((void *)-1)
+
+#define MADV_NORMAL 0   // 无特别建议
+#define MADV_WILLNEED 3 // 预先装入
+#define MADV_DONTNEED 4 // 释放物理页，地址范围保留，再次访问时重新装入；共享映射不受影响
+
+#define SPAWN_ACTION_END 0   // 操作列表的结束标记
+#define SPAWN_ACTION_DUP2 1  // 子进程中将fd复制到new_fd
+#define SPAWN_ACTION_CLOSE 2 // 子进程中关闭fd
+
+#define IPC_PRIVATE 0     // 总是创建新的共享内存段
+#define IPC_CREAT 0x200   // 不存在时创建
+#define IPC_EXCL 0x400    // 与IPC_CREAT同用，已存在时失败
+#define IPC_RMID 0        // shmctl: 删除共享内存段
+#define SHM_RDONLY 0x1000 // shmat: 只读映射
+
+#define FUTEX_WOKEN 0   // futex_wait: 被唤醒
+#define FUTEX_AGAIN 1   // futex_wait: 值已不等于预期，未等待
+#define FUTEX_TIMEOUT 2 // futex_wait: 超时
+
+#define RING_OP_NOP 0
+#define RING_OP_READ 1
+#define RING_OP_WRITE 2
+#define RING_OP_OPEN 3  // addr为路径，flags为打开方式
+#define RING_OP_CLOSE 4
+
+#define RING_ENTRIES_MAX 256 // 队列的最大项数
+
+// 以下内容汇编文件中不可用
+#ifndef __ASSEMBLER__
+
+#include "comm/types.h"
+
+/**
+ * mmap参数超过系统调用可传递的个数，通过结构传入
+ */
+typedef struct _mmap_args_t
+{
+    void *addr;
+    uint32_t length;
+    int prot;
+    int flags;
+    int fd;
+    uint32_t offset;
+} mmap_args_t;
+
+typedef struct _spawn_action_t
+{
+    int type;
+    int fd;
+    int new_fd;
+} spawn_action_t;
+
+/**
+ * 提交队列中的一项操作
+ */
+typedef struct _ring_sqe_t
+{
+    int opcode;
+    int fd;
+    void *addr; // 读写的缓冲区或打开的路径
+    int len;
+    int flags;
+    uint32_t user_data; // 原样带回到完成项中
+} ring_sqe_t;
+
+/**
+ * 完成队列中的一项，res为对应系统调用的返回值
+ */
+typedef struct _ring_cqe_t
+{
+    uint32_t user_data;
+    int res;
+} ring_cqe_t;
+
+/**
+ * 异步提交的环形队列，位于用户内存，项数为2的幂
+ * 提交队列由用户移动tail、内核移动head，完成队列相反，计数一直增加，取模得到下标
+ * 注册后entries、sqes、cqes不能再改，操作执行期间缓冲区不能解除映射
+ */
+typedef struct _ring_t
+{
+    uint32_t entries;
+    volatile uint32_t sq_head, sq_tail;
+    volatile uint32_t cq_head, cq_tail;
+    ring_sqe_t *sqes;
+    ring_cqe_t *cqes;
+} ring_t;
+
+/**
+ * 物理内存的使用情况，除累计次数外单位均为页
+ */
+typedef struct _mem_stat_t
+{
+    uint32_t total;      // 可分配的页，含高端内存
+    uint32_t free;
+    uint32_t high_total;
+    uint32_t high_free;
+    uint32_t page_table; // 页目录和页表
+    uint32_t slab;       // 内核对象缓存及kmalloc
+    uint32_t zero_pool;  // 预清零池中的页
+    uint32_t page_fault; // 累计缺页次数
+    uint32_t fork_share; // fork时与子进程共享的页
+    uint32_t cow_copy;   // 写时复制时实际复制的页
+} mem_stat_t;
+
+#define TASK_STAT_NAME_SIZE 32
+
+/**
+ * 单个进程的状态及内存使用
+ */
+typedef struct _task_stat_t
+{
+    int pid;
+    int ppid;
+    char state; // R-运行 r-就绪 S-睡眠 W-等待 Z-僵尸 C-已创建
+    int nice;
+    int cpu; // 所在就绪队列的CPU
+    char name[TASK_STAT_NAME_SIZE];
+    uint32_t rss;        // 已映射的物理页
+    uint32_t page_fault;
+    uint32_t cow_copy;
+} task_stat_t;
+
 void exception_handler_syscall(void);
+void exception_handler_sysenter(void);
 
 typedef struct _syscall_frame_t
 {
@@ -40,4 +193,6 @@ typedef struct _syscall_frame_t
     int esp, ss;
 } syscall_frame_t;
 
+#endif
+
 #endif
\ No newline at end of file
@@ -4,13 +4,23 @@
 #include "comm/types.h"
 #include "cpu/cpu.h"
 #include "tools/list.h"
+#include "ipc/spinlock.h"
 #include "fs/file.h"
+#include "core/syscall.h"
+#include "os_cfg.h"
 
 #define TASK_NAME_SIZE 32
 #define TASK_TIME_SLICE_DEFAULT 10
 #define TASK_OFILE_NR 128
 
 #define TASK_FLAGS_SYSTEM (1 << 0)
+#define TASK_FLAGS_IDLE (1 << 1) // 各CPU的空闲任务，不在就绪队列中
+
+#define TASK_PRIO_NR 32       // 优先级数，0为最高，每个优先级一个就绪队列
+#define TASK_PRIO_KERNEL 4    // 内核线程，如网络协议栈的工作线程
+#define TASK_PRIO_DEFAULT 16  // 普通进程，对应nice值0
+#define TASK_NICE_MIN -8      // 用户进程的优先级不能高于内核线程
+#define TASK_NICE_MAX (TASK_PRIO_NR - 1 - TASK_PRIO_DEFAULT)
 
 #define TASK_STATUS_TMO	-1
 
@@ -21,9 +31,22 @@ typedef struct _task_args_t
     char **argv;
 } task_args_t;
 
+/**
+ * 任务首次运行前内核栈上的现场，由simple_switch和task_entry依次弹出
+ */
+typedef struct _task_frame_t
+{
+    uint32_t switch_regs[4]; // simple_switch弹出的edi, esi, ebx, ebp
+    uint32_t ret;            // simple_switch返回到task_entry
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, dummy, ebx, edx, ecx, eax;
+    uint32_t eip, cs, eflags;
+    uint32_t esp, ss; // 返回用户态时才由iret弹出
+} task_frame_t;
+
 typedef struct _task_t
 {
-    // uint32_t *stack;
+    uint32_t *stack; // 切换出去时保存的内核栈指针
     enum
     {
         TASK_CRATED,
@@ -35,44 +58,72 @@ typedef struct _task_t
     } state;
 
     int pid;
+    int flags;
     struct _task_t *parent;
+    struct _task_t *vfork_parent; // vfork创建时借用其地址空间的父进程
     uint32_t heap_start;
     uint32_t heap_end;
+    list_t region_list; // 按需分页的地址空间区域
 
-    int sleep_ticks;
-    int time_ticks;
+    int prio;
+    int sleep_ms; // 在睡眠队列中时，为相对前一个任务的到期差值
+    int time_ticks; // 时间片长度，随优先级变化
     int slice_ticks;
     int status;
 
+    uint32_t page_fault; // 累计缺页次数
+    uint32_t cow_copy;   // 写时复制时复制的页数
+
     file_t *file_table[TASK_OFILE_NR];
     char name[TASK_NAME_SIZE];
     list_node_t run_node;
     list_t * wait_list;			// 正在等等的队列
     list_node_t wait_node;
+    uint32_t futex_paddr;   // 在futex上等待时，等待位置的物理地址
     list_node_t all_node;
-    tss_t tss;
-    int tss_sel;
+    uint32_t esp0; // 内核栈顶，内核线程为0
+    uint32_t cr3;
+
+    int cpu;        // 所在就绪队列属于哪个CPU
+    int migrated;   // 被其它CPU取走后尚未运行，需刷新TLB
+    int lock_depth; // 切换出去时持有内核锁的嵌套深度
+
+    struct _task_t *owner;        // 代其执行操作的进程，使用该进程的地址空间和文件表
+    struct _ring_worker_t *ring;  // 进程的异步操作队列
 } task_t;
 
 int task_init(task_t *task, const char *name, int flag, uint32_t entry, uint32_t esp);
 
 void task_switch_from_to(task_t *from, task_t *to);
+void simple_switch(uint32_t **from, uint32_t *to);
+void task_entry(void);
 
-typedef struct _task_manager_t
+/**
+ * 每个CPU的运行队列
+ */
+typedef struct _task_rq_t
 {
     task_t *curr_task;
-    list_t ready_list;
+    list_t ready_list[TASK_PRIO_NR]; // 运行中的进程也留在其队列的头部
+    uint32_t ready_bitmap;           // 第i位为1表示优先级i的就绪队列非空
+    int ready_count;                 // 队列中的任务数，含运行中的
+    uint32_t dead_cr3;               // 已回收但本CPU的内核线程仍在借用的页目录，切换走后释放
+    task_t idle_task;
+} task_rq_t;
+
+typedef struct _task_manager_t
+{
+    task_rq_t rq[OS_CPU_MAX];
     list_t task_list;
-    list_t sleep_list;
+    spinlock_t list_lock; // 保护task_list，不依赖内核锁
+    list_t sleep_list; // 按到期时间排序的差值队列，所有CPU共用
 
     task_t first_task;
-    task_t idle_task;
-
-    int app_code_sel;
-    int app_data_sel;
 } task_manager_t;
 
 void task_manager_init(void);
+void task_idle_init(int cpu);
+void task_idle_start(void);
 
 void task_first_init(void);
 
@@ -84,10 +135,11 @@ void sys_exit(int status);
 int sys_wait(int *status);
 
 task_t *task_current(void);
+task_t *task_current_proc(void);
 
 void task_dispatch(void);
 
-void task_time_tick();
+void task_time_tick(uint32_t ms);
 
 file_t *task_file(int fd);
 int task_alloc_fd(file_t *file);
@@ -95,11 +147,27 @@ void task_remove_fd(int fd);
 
 void task_set_ready(task_t *task);
 void task_set_block(task_t *task);
-void task_set_sleep(task_t *task, uint32_t ticks);
+void task_set_sleep(task_t *task, uint32_t ms);
 void task_set_wakeup(task_t *task);
+void task_sleep_advance(uint32_t ms);
+int task_sleep_remain(void);
+int task_has_ready(void);
 int sys_getpid(void);
 int sys_fork(void);
 int sys_execve(char *name, char **argv, char **env);
+int sys_vfork(void);
+int sys_spawn(const char *name, char **argv, char **env, spawn_action_t *actions);
+int sys_taskinfo(task_stat_t *stat, int count);
 void task_start(task_t * task);
+void task_uninit(task_t *task);
+int task_defer_page_dir(uint32_t page_dir);
+void task_set_priority(task_t *task, int prio);
+int sys_setpriority(int pid, int nice);
+int sys_getpriority(int pid);
+
+#if OS_BENCH
+void task_sleep_bench(void);
+void task_switch_bench(void);
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "comm/types.h"
+
+// 本地APIC的寄存器偏移
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LO 0x300
+#define LAPIC_ICR_HI 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_LVT_NMI (4 << 8)
+#define LAPIC_LVT_EXTINT (7 << 8) // 8259的中断经此引脚送入
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_DIV16 0x3
+
+#define LAPIC_ICR_FIXED (0 << 8)
+#define LAPIC_ICR_INIT (5 << 8)
+#define LAPIC_ICR_STARTUP (6 << 8)
+#define LAPIC_ICR_PENDING (1 << 12) // 尚未被目标接收
+#define LAPIC_ICR_ASSERT (1 << 14)
+#define LAPIC_ICR_LEVEL (1 << 15)
+
+void lapic_init(uint32_t paddr);
+void lapic_init_ap(void);
+int lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(int apic_id, int vector);
+void lapic_start_ap(int apic_id, uint32_t addr);
+void lapic_udelay(int us);
+
+void exception_handler_lapic_timer(void);
+void exception_handler_resched(void);
+void exception_handler_spurious(void);
+
+#endif
@@ -5,6 +5,11 @@
 
 #define EFLAGS_DEFAULT (1 << 1)
 #define EFLAGS_IF (1 << 9)
+#define CR0_TS (1 << 3) // 硬件任务切换后置位，之后首次使用浮点指令产生异常
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
 
 #pragma pack(1)
 typedef struct _segment_desc_t
@@ -69,6 +74,8 @@ void segment_desc_set(int selector, uint32_t base,
                       uint32_t limit, uint16_t attr);
 
 void cpu_init(void);
+void cpu_init_ap(int id);
+int cpu_id(void);
 
 void gate_desc_set(gate_desc_t *desc, uint16_t selector,
                    uint32_t offset, uint16_t attr);
@@ -76,6 +83,8 @@ void gate_desc_set(gate_desc_t *desc, uint16_t selector,
 int gdt_alloc_desc();
 
 void switch_to_tss(int tss_sel);
+void tss_set_esp0(uint32_t esp0);
+tss_t *tss_get(void);
 
 void gdt_free_sel(int tss_sel);
 
@@ -29,9 +29,13 @@
 
 #define IRQ14_HARDDISK_PRIMARY 0x2E
 
+#define IRQ_LAPIC_TIMER 0x30 // AP的本地定时器
+#define IRQ_RESCHED 0x31     // 处理器间中断：重新调度
+#define IRQ_SPURIOUS 0x3F    // 本地APIC的伪中断，低4位须为1
+
 #define ERR_PAGE_P (1 << 0)
 #define ERR_PAGE_WR (1 << 1)
-#define ERR_PAGE_US (1 << 1)
+#define ERR_PAGE_US (1 << 2)
 
 #define ERR_EXT (1 << 0)
 #define ERR_IDT (1 << 1)
@@ -53,6 +57,7 @@ typedef struct _exception_frame_t
 typedef void (*irq_handler_t)(void);
 
 void irq_init(void);
+void irq_init_ap(void);
 int irq_install(int irq_num, irq_handler_t handler);
 
 void exception_handler_unknown(void);
@@ -109,5 +114,8 @@ void pic_send_eoi(int irq_num);
 typedef uint32_t irq_state_t;
 irq_state_t irq_enter_protection(void);
 void irq_leave_protection(irq_state_t state);
+void irq_lock_kernel(void);
+void irq_unlock_kernel(void);
+int irq_swap_lock_depth(int depth);
 
 #endif
\ No newline at end of file
@@ -13,6 +13,19 @@
 #define PTE_W (1 << 1)
 #define PDE_U (1 << 2)
 #define PTE_U (1 << 2)
+#define PTE_PWT (1 << 3) // 直写
+#define PTE_PCD (1 << 4) // 禁止缓存，映射设备寄存器时使用
+#define PDE_PS (1 << 7) // 4MB大页
+#define PDE_G (1 << 8)  // 全局页，仅对大页有效
+#define PTE_G (1 << 8)  // 全局页，切换CR3时不从TLB中清除
+#define PTE_COW (1 << 9) // 软件自定义位：写时复制
+#define PTE_SHARED (1 << 10) // 软件自定义位：共享映射，fork时不做写时复制
+
+#define CR0_WP (1 << 16) // 特权级0写只读页时也产生异常
+#define CR4_PSE (1 << 4) // 允许4MB大页
+#define CR4_PGE (1 << 7) // 允许全局页
+
+#define MMU_FLUSH_PAGE_MAX 32 // 超过该页数时直接重新加载CR3
 
 typedef union _pde_t
 {
@@ -76,9 +89,33 @@ static inline void mmu_set_page_dir(uint32_t paddr)
     write_cr3(paddr);
 }
 
+/**
+ * 页表项修改后清除对应的TLB项，未在使用中的页目录无需处理
+ */
+static inline void mmu_flush_page(uint32_t page_dir, uint32_t vaddr)
+{
+    if (page_dir == read_cr3())
+        invlpg(vaddr);
+}
+
+static inline void mmu_flush_range(uint32_t page_dir, uint32_t start, uint32_t end)
+{
+    if (page_dir != read_cr3())
+        return;
+
+    if (((end - start) >> 12) > MMU_FLUSH_PAGE_MAX)
+    {
+        write_cr3(page_dir);
+        return;
+    }
+
+    for (uint32_t vaddr = start; vaddr < end; vaddr += (1 << 12))
+        invlpg(vaddr);
+}
+
 static inline uint32_t get_pte_perm(pte_t *pte)
 {
-    return (pte->v & 0x3FF);
+    return (pte->v & 0xFFF);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "comm/types.h"
+
+#define MP_ENTRY_PROC 0         // 处理器项，长20字节，其余项均为8字节
+#define MP_PROC_ENABLED (1 << 0)
+#define MP_PROC_BSP (1 << 1)
+
+#define BDA_EBDA_SEG 0x40E      // BIOS数据区中EBDA的段地址
+#define BDA_BASE_MEM_KB 0x413   // 基本内存的KB数
+#define BDA_WARM_RESET 0x467    // 热启动时BIOS跳转的地址，偏移在前
+
+#define CMOS_ADDR_PORT 0x70
+#define CMOS_DATA_PORT 0x71
+#define CMOS_SHUTDOWN 0x0F
+#define CMOS_SHUTDOWN_WARM 0x0A // 热启动，跳转到BDA_WARM_RESET处
+
+#pragma pack(1)
+
+/**
+ * MP浮点指针结构，位于EBDA的第1KB、基本内存的最后1KB或BIOS ROM中，16字节对齐
+ */
+typedef struct _mp_float_t
+{
+    char sig[4]; // "_MP_"
+    uint32_t config;
+    uint8_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t feature[5];
+} mp_float_t;
+
+typedef struct _mp_config_t
+{
+    char sig[4]; // "PCMP"
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_length;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} mp_config_t;
+
+typedef struct _mp_proc_t
+{
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t feature;
+    uint8_t reserved[8];
+} mp_proc_t;
+
+/**
+ * AP启动参数，与ap_start.S中的布局一致
+ */
+typedef struct _ap_boot_t
+{
+    uint16_t gdt_limit;
+    uint32_t gdt_base;
+    uint32_t cr0, cr3, cr4;
+    uint32_t esp;
+    uint32_t entry;
+} ap_boot_t;
+
+#pragma pack()
+
+void smp_init(void);
+int smp_cpu_count(void);
+void smp_send_resched(int cpu);
+
+#endif
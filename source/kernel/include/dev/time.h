@@ -7,14 +7,34 @@
 
 // 定时器的寄存器和各项位配置
 #define PIT_CHANNEL0_DATA_PORT 0x40
+#define PIT_CHANNEL2_DATA_PORT 0x42
 #define PIT_COMMAND_MODE_PORT 0x43
 
 #define PIT_CHANNLE0 (0 << 6)
+#define PIT_CHANNLE2 (2 << 6)
 #define PIT_LOAD_LOHI (3 << 4)
+#define PIT_MODE0 (0 << 1) // 计到0时产生一次中断
 #define PIT_MODE3 (3 << 1)
+#define PIT_COUNT_MAX 0xFFFF
+
+// 回读命令，同时锁存通道0的状态和计数值
+#define PIT_READ_BACK (3 << 6)
+#define PIT_RB_CHANNEL0 (1 << 1)
+#define PIT_STATUS_OUT (1 << 7)  // OUT引脚电平
+#define PIT_STATUS_NULL (1 << 6) // 新装入的计数值尚未生效
+
+// 通道2的门控和输出经由扬声器控制端口，用于校准本地APIC定时器
+#define PIT_SPEAKER_PORT 0x61
+#define PIT_SPEAKER_GATE2 (1 << 0)
+#define PIT_SPEAKER_DATA (1 << 1)
+#define PIT_SPEAKER_OUT2 (1 << 5)
 
 void time_init(void);
 void exception_handler_time(void);
 uint32_t sys_get_ticks (void);
+uint32_t sys_get_ms(void);
+
+void time_idle(void);
+void time_idle_exit(void);
 
 #endif
\ No newline at end of file
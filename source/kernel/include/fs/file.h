@@ -4,7 +4,6 @@
 #include "comm/types.h"
 
 #define FILE_NAME_SIZE 32
-#define FILE_TABLE_SIZE 2048
 
 typedef enum _file_type_t
 {
@@ -35,5 +34,6 @@ file_t *file_alloc(void);
 void file_free(file_t *file);
 void file_table_init(void);
 void file_inc_ref(file_t *file);
+int file_dec_ref(file_t *file);
 
 #endif
\ No newline at end of file
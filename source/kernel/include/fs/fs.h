@@ -71,4 +71,8 @@ int sys_readdir(DIR *dir, struct dirent *dirent);
 int sys_closedir(DIR *dir);
 int sys_unlink(const char *path);
 
+void fs_close_file(file_t *file);
+int fs_read_file(file_t *file, uint32_t offset, char *buf, int size);
+int fs_write_file(file_t *file, uint32_t offset, char *buf, int size);
+
 #endif
\ No newline at end of file
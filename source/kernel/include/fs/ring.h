@@ -0,0 +1,46 @@
+#ifndef RING_H
+#define RING_H
+
+#include "comm/types.h"
+#include "core/task.h"
+#include "core/syscall.h"
+#include "ipc/sem.h"
+
+#define RING_WORKER_STACK_SIZE 4096 // 与进程的内核栈一样大
+#define RING_PATH_MAX 256           // 打开操作的路径最大长度，含结尾的0
+
+/**
+ * 代进程执行队列中操作的内核线程，使用进程的地址空间和文件表
+ * 队列的位置和大小在注册时复制一份，执行时不再读用户修改的值
+ */
+typedef struct _ring_worker_t
+{
+    task_t task;
+    uint32_t stack[RING_WORKER_STACK_SIZE / sizeof(uint32_t)];
+
+    ring_t *ring;
+    uint32_t entries;
+    ring_sqe_t *sqes;
+    ring_cqe_t *cqes;
+
+    uint32_t sq_head;  // 已取走的提交项
+    uint32_t sq_limit; // 已提交、允许执行到的位置
+    uint32_t cq_tail;  // 已写入的完成项
+
+    sem_t submit_sem; // 有新的提交或需要退出时通知线程
+    sem_t wait_sem;   // 线程有进展时通知等待中的进程
+    int waiting;      // 进程正在wait_sem上等待
+    int running;      // 正在执行一项操作，期间可能阻塞
+    int paused;       // 进程修改地址空间期间不开始新的操作
+    int stop;
+} ring_worker_t;
+
+void ring_release(task_t *task);
+void ring_pause(task_t *task);
+void ring_resume(task_t *task);
+
+int sys_ring_setup(ring_t *ring);
+int sys_ring_enter(ring_t *ring, int to_submit, int min_complete);
+int sys_ring_release(void);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "comm/types.h"
+
+#define FUTEX_HASH_NR 64 // 等待队列的散列桶数
+
+void futex_init(void);
+
+int sys_futex_wait(uint32_t addr, uint32_t expected, int ms);
+int sys_futex_wake(uint32_t addr, int count);
+
+#endif
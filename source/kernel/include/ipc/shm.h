@@ -0,0 +1,27 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "comm/types.h"
+#include "tools/list.h"
+
+/**
+ * 共享内存段，物理页在创建时分配，映射到各进程时增加页的引用计数
+ */
+typedef struct _shm_t
+{
+    int key;
+    int id;
+    uint32_t size;
+    int page_count;
+    uint32_t *pages;
+    list_node_t node;
+} shm_t;
+
+void shm_init(void);
+
+int sys_shmget(int key, uint32_t size, int flags);
+int sys_shmat(int id, uint32_t addr, int flags);
+int sys_shmdt(uint32_t addr);
+int sys_shmctl(int id, int cmd);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "comm/types.h"
+#include "comm/cpu_instr.h"
+
+/**
+ * 自旋锁，用于多个CPU之间的互斥，持有期间不能睡眠
+ */
+typedef struct _spinlock_t
+{
+    volatile uint32_t locked;
+} spinlock_t;
+
+static inline void spin_init(spinlock_t *lock)
+{
+    lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    // 被占用时只读等待，避免反复锁总线
+    while (xchg(&lock->locked, 1))
+    {
+        while (lock->locked)
+            pause();
+    }
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    __asm__ __volatile__("" ::: "memory");
+    lock->locked = 0;
+}
+
+/**
+ * 先关本CPU的中断再加锁，持锁期间本CPU上的中断处理不会再来获取同一个锁
+ */
+static inline uint32_t spin_lock_irqsave(spinlock_t *lock)
+{
+    uint32_t state = read_eflags();
+    cli();
+    spin_lock(lock);
+    return state;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t state)
+{
+    spin_unlock(lock);
+    write_eflags(state);
+}
+
+#endif
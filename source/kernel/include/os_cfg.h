@@ -5,17 +5,25 @@
 
 #define KERNEL_SELECTOR_CS (1 * 8)
 #define KERNEL_SELECTOR_DS (2 * 8)
-#define SELECTOR_SYSCALL (3 * 8)
+#define APP_SELECTOR_CS (3 * 8) // sysexit要求用户的代码段、数据段紧跟在内核的之后
+#define APP_SELECTOR_DS (4 * 8)
+#define SELECTOR_SYSCALL (5 * 8)
+#define KERNEL_SELECTOR_TSS (6 * 8) // 每个CPU一个TSS，依次排列，只用于进入内核时取esp0
 #define KERNEL_STACK_SIZE (8 * 1024)
 
 #define OS_TICK_MS 10
+#define OS_TICKLESS 1 // 1 - 空闲时停止周期时钟，按最早到期的睡眠任务单次定时
 
 #define OS_VERSION "1.0.0"
 
 #define IDLE_TASK_STACK_SIZE 1024
 
-#define TASK_NR 128
+#define OS_CPU_MAX 8 // 最多支持的CPU数
+#define SMP_AP_START 0x6000 // AP的启动代码复制到此处，需在1MB以下且4KB对齐
 
 #define ROOT_DEV DEV_DISK, 0xb1
 
+#define OS_BENCH 0 // 1 - 启动时运行内核性能测试，结果输出到日志
+#define OS_LOG_DEBUG 0 // 1 - 输出调试日志，如每次sbrk的调用
+
 #endif
\ No newline at end of file
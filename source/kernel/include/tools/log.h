@@ -1,7 +1,16 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include "os_cfg.h"
+
 void log_init(void);
 void log_printf(const char *fmt, ...);
 
+// 调试日志，频繁调用的路径上使用，默认不输出
+#if OS_LOG_DEBUG
+#define log_debug(fmt, ...) log_printf(fmt, ##__VA_ARGS__)
+#else
+#define log_debug(fmt, ...)
+#endif
+
 #endif
\ No newline at end of file
@@ -35,23 +35,16 @@ int first_task_main(void)
 
     for (int i = 0; i < TTY_NR; i++)
     {
-        int pid = fork();
+        char tty_num[] = "/dev/tty?";
+        tty_num[sizeof(tty_num) - 2] = i + '0';
+        char *argv[] = {tty_num, (char *)0};
+
+        int pid = spawn("shell.elf", argv, (char **)0, (const spawn_action_t *)0);
         if (pid < 0)
         {
             print_msg("create shell failed.", 0);
             break;
         }
-        else if (pid == 0)
-        {
-            char tty_num[] = "/dev/tty?";
-            tty_num[sizeof(tty_num) - 2] = i + '0';
-            char *argv[] = {tty_num, (char *)0};
-            execve("shell.elf", argv, (char **)0);
-            while (1)
-            {
-                msleep(1000);
-            }
-        }
     }
 
     for (;;)
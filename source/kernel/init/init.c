@@ -12,6 +12,10 @@
 #include "core/memory.h"
 #include "dev/kbd.h"
 #include "fs/fs.h"
+#include "ipc/shm.h"
+#include "ipc/futex.h"
+#include "core/image.h"
+#include "cpu/smp.h"
 
 void kernel_init(boot_info_t *boot_info)
 {
@@ -22,27 +26,33 @@ void kernel_init(boot_info_t *boot_info)
     log_init();
 
     memory_init(boot_info);
+#if OS_BENCH
+    memory_bench();
+#endif
     fs_init();
+    image_init();
+    shm_init();
+    futex_init();
     time_init();
 
     task_manager_init();
+#if OS_BENCH
+    task_sleep_bench();
+    task_switch_bench();
+#endif
 }
 
 void move_to_first_task(void)
 {
     task_t *curr = task_current();
     ASSERT(curr != 0);
-    tss_t *tss = &(curr->tss);
-    __asm__ __volatile__("push %[ss]\n\t"
-                         "push %[esp]\n\t"
-                         "push %[eflags]\n\t"
-                         "push %[cs]\n\t"
-                         "push %[eip]\n\t"
-                         "iret" ::[ss] "r"(tss->ss),
-                         [esp] "r"(tss->esp),
-                         [eflags] "r"(tss->eflags),
-                         [cs] "r"(tss->cs),
-                         [eip] "r"(tss->eip));
+
+    // 启动时的栈之后不再使用，切换到首个任务构造好的现场
+    // 内核锁在task_entry中释放
+    uint32_t *boot_stack;
+    irq_enter_protection();
+    tss_set_esp0(curr->esp0);
+    simple_switch(&boot_stack, curr->stack);
 }
 
 void init_main()
@@ -52,6 +62,7 @@ void init_main()
     log_printf("Version: %s %s", OS_VERSION, "diy x86-os");
     log_printf("========================");
 
+    smp_init();
     task_first_init();
     move_to_first_task();
 }
\ No newline at end of file
@@ -72,6 +72,18 @@ int execve(const char *name, char *const *argv, char *const *env)
     return sys_call(&args);
 }
 
+int spawn(const char *name, char *const *argv, char *const *env, const spawn_action_t *actions)
+{
+    syscall_args_t args;
+    args.id = SYS_spawn;
+    args.arg0 = (int)name;
+    args.arg1 = (int)argv;
+    args.arg2 = (int)env;
+    args.arg3 = (int)actions;
+
+    return sys_call(&args);
+}
+
 int yield(void)
 {
     syscall_args_t args;
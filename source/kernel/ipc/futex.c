@@ -0,0 +1,102 @@
+#include "ipc/futex.h"
+#include "core/task.h"
+#include "core/memory.h"
+#include "core/syscall.h"
+#include "cpu/irq.h"
+#include "tools/list.h"
+
+// 按物理地址散列，不同进程经共享内存映射的同一位置落在同一个桶中
+static list_t futex_table[FUTEX_HASH_NR];
+
+static list_t *futex_bucket(uint32_t paddr)
+{
+    return futex_table + (paddr >> 2) % FUTEX_HASH_NR;
+}
+
+void futex_init(void)
+{
+    for (int i = 0; i < FUTEX_HASH_NR; i++)
+        list_init(futex_table + i);
+}
+
+/**
+ * @brief addr处的值仍为expected时等待，ms大于0时最多等待ms毫秒
+ * 比较与加入等待队列在同一临界区内完成，与唤醒之间不会错过
+ */
+int sys_futex_wait(uint32_t addr, uint32_t expected, int ms)
+{
+    if (addr & (sizeof(uint32_t) - 1))
+        return -1;
+
+    uint32_t paddr = memory_user_paddr(addr);
+    if (paddr == 0)
+        return -1;
+
+    irq_state_t state = irq_enter_protection();
+
+    if (*(volatile uint32_t *)addr != expected)
+    {
+        irq_leave_protection(state);
+        return FUTEX_AGAIN;
+    }
+
+    task_t *curr = task_current();
+    task_set_block(curr);
+    if (ms > 0)
+        task_set_sleep(curr, ms);
+
+    list_t *bucket = futex_bucket(paddr);
+    curr->futex_paddr = paddr;
+    curr->status = 0;
+    curr->wait_list = bucket;
+    list_insert_last(bucket, &curr->wait_node);
+
+    task_dispatch();
+    irq_leave_protection(state);
+
+    return (curr->status == TASK_STATUS_TMO) ? FUTEX_TIMEOUT : FUTEX_WOKEN;
+}
+
+/**
+ * @brief 唤醒最多count个在addr上等待的任务，返回唤醒的个数
+ */
+int sys_futex_wake(uint32_t addr, int count)
+{
+    if (addr & (sizeof(uint32_t) - 1))
+        return -1;
+
+    uint32_t paddr = memory_user_paddr(addr);
+    if (paddr == 0)
+        return -1;
+
+    irq_state_t state = irq_enter_protection();
+
+    int woken = 0;
+    list_t *bucket = futex_bucket(paddr);
+    list_node_t *node = list_first(bucket);
+    while (node && (woken < count))
+    {
+        task_t *task = list_node_parent(node, task_t, wait_node);
+        node = list_node_next(node);
+        if (task->futex_paddr != paddr)
+            continue;
+
+        list_remove(bucket, &task->wait_node);
+
+        // 同时在超时等待的，从睡眠队列中移除
+        if (task->state == TASK_SLEEPING)
+            task_set_wakeup(task);
+
+        task_set_ready(task);
+        task->status = 0;
+        task->wait_list = (list_t *)0;
+        task->sleep_ms = 0;
+        woken++;
+    }
+
+    if (woken)
+        task_dispatch();
+
+    irq_leave_protection(state);
+    return woken;
+}
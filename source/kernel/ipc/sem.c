@@ -39,7 +39,7 @@ int sem_wait_tmo(sem_t *sem, int ms) {
         task_t *curr = task_current();
         task_set_block(curr);
         if(ms > 0) {
-            task_set_sleep(curr, (ms + (OS_TICK_MS - 1))/ OS_TICK_MS);
+            task_set_sleep(curr, ms);
         }
 
         curr->wait_list = &sem->wait_list;
@@ -64,7 +64,7 @@ void sem_notify(sem_t *sem)
         task_t *task = list_node_parent(node, task_t, wait_node);
         
         // 如果进程同时还延时，先延时队列中移除
-        if(task->sleep_ticks > 0)
+        if(task->state == TASK_SLEEPING)
         {
             task_set_wakeup(task);
         }
@@ -72,7 +72,7 @@ void sem_notify(sem_t *sem)
         task_set_ready(task);
         task->status = 0;
         task->wait_list = (list_t *)0;
-        task->sleep_ticks = 0;
+        task->sleep_ms = 0;
         task_dispatch();
     }
     else
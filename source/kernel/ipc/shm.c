@@ -0,0 +1,177 @@
+#include "ipc/shm.h"
+#include "ipc/mutex.h"
+#include "core/kmem.h"
+#include "core/memory.h"
+#include "core/syscall.h"
+#include "cpu/mmu.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+
+static list_t shm_list;
+static mutex_t shm_mutex;
+static kmem_cache_t shm_cache;
+static int shm_next_id;
+
+static shm_t *shm_find_key(int key)
+{
+    list_node_t *node = list_first(&shm_list);
+    while (node)
+    {
+        shm_t *shm = list_node_parent(node, shm_t, node);
+        if (shm->key == key)
+            return shm;
+
+        node = list_node_next(node);
+    }
+
+    return (shm_t *)0;
+}
+
+static shm_t *shm_find_id(int id)
+{
+    list_node_t *node = list_first(&shm_list);
+    while (node)
+    {
+        shm_t *shm = list_node_parent(node, shm_t, node);
+        if (shm->id == id)
+            return shm;
+
+        node = list_node_next(node);
+    }
+
+    return (shm_t *)0;
+}
+
+/**
+ * 释放段对物理页的引用，已映射的进程仍持有引用，页在最后一个进程解除映射后才回收
+ */
+static void shm_free(shm_t *shm)
+{
+    for (int i = 0; i < shm->page_count; i++)
+    {
+        if (shm->pages[i])
+            memory_free_page(shm->pages[i]);
+    }
+
+    kfree(shm->pages);
+    kmem_cache_free(&shm_cache, shm);
+}
+
+static shm_t *shm_create(int key, uint32_t size)
+{
+    shm_t *shm = (shm_t *)kmem_cache_alloc(&shm_cache);
+    if (shm == (shm_t *)0)
+        return (shm_t *)0;
+
+    shm->key = key;
+    shm->id = shm_next_id++;
+    shm->size = size;
+    shm->page_count = up2(size, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
+    shm->pages = (uint32_t *)kmalloc(shm->page_count * sizeof(uint32_t));
+    if (shm->pages == (uint32_t *)0)
+    {
+        kmem_cache_free(&shm_cache, shm);
+        return (shm_t *)0;
+    }
+
+    kernel_memset(shm->pages, 0, shm->page_count * sizeof(uint32_t));
+    for (int i = 0; i < shm->page_count; i++)
+    {
+        shm->pages[i] = memory_alloc_zero_page();
+        if (shm->pages[i] == 0)
+        {
+            log_printf("shm: no memory for %d bytes", size);
+            shm_free(shm);
+            return (shm_t *)0;
+        }
+    }
+
+    list_insert_last(&shm_list, &shm->node);
+    return shm;
+}
+
+void shm_init(void)
+{
+    list_init(&shm_list);
+    mutex_init(&shm_mutex);
+    kmem_cache_init(&shm_cache, "shm", sizeof(shm_t), 0);
+    shm_next_id = 1;
+}
+
+/**
+ * @brief 按键值获取共享内存段，不存在且带IPC_CREAT时创建
+ */
+int sys_shmget(int key, uint32_t size, int flags)
+{
+    int id = -1;
+    mutex_lock(&shm_mutex);
+
+    shm_t *shm = (key == IPC_PRIVATE) ? (shm_t *)0 : shm_find_key(key);
+    if (shm)
+    {
+        if ((flags & IPC_CREAT) && (flags & IPC_EXCL))
+            log_printf("shm: key %d exists", key);
+        else if (size > shm->size)
+            log_printf("shm: key %d is smaller than %d", key, size);
+        else
+            id = shm->id;
+    }
+    else if ((key == IPC_PRIVATE) || (flags & IPC_CREAT))
+    {
+        if (size > 0)
+        {
+            shm = shm_create(key, size);
+            if (shm)
+                id = shm->id;
+        }
+    }
+
+    mutex_unlock(&shm_mutex);
+    return id;
+}
+
+/**
+ * @brief 将共享内存段映射到当前进程，addr为0时由内核选择地址
+ */
+int sys_shmat(int id, uint32_t addr, int flags)
+{
+    if (flags & ~SHM_RDONLY)
+        return -1;
+
+    uint32_t perm = PTE_P | PTE_U | PTE_SHARED | ((flags & SHM_RDONLY) ? 0 : PTE_W);
+    uint32_t vaddr = 0;
+    mutex_lock(&shm_mutex);
+
+    shm_t *shm = shm_find_id(id);
+    if (shm)
+        vaddr = memory_map_pages(addr, shm->pages, shm->page_count, perm, MEM_REGION_SHARED | MEM_REGION_SHM);
+
+    mutex_unlock(&shm_mutex);
+    return vaddr ? vaddr : -1;
+}
+
+int sys_shmdt(uint32_t addr)
+{
+    return memory_unmap_region(addr, MEM_REGION_SHM);
+}
+
+/**
+ * @brief 删除共享内存段，键值立即失效，已映射的进程可继续使用直到解除映射
+ */
+int sys_shmctl(int id, int cmd)
+{
+    if (cmd != IPC_RMID)
+        return -1;
+
+    mutex_lock(&shm_mutex);
+
+    shm_t *shm = shm_find_id(id);
+    if (shm)
+    {
+        list_remove(&shm_list, &shm->node);
+        shm_free(shm);
+    }
+
+    mutex_unlock(&shm_mutex);
+    return shm ? 0 : -1;
+}
@@ -36,15 +36,15 @@ static mutex_t mutex_tbl[NET_MUTEX_NR];
 static mblock_t mutex_mblock;
 
 void sys_time_curr (net_time_t * time) {
-    *time = sys_get_ticks();
+    *time = sys_get_ms();
 }
 
 int sys_time_goes (net_time_t * pre) {
     // 获取当前时间
-    net_time_t curr = sys_get_ticks();
+    net_time_t curr = sys_get_ms();
 
     // 记录过去了多少毫秒
-   int diff_ms = (curr - *pre) * OS_TICK_MS;
+   int diff_ms = curr - *pre;
 
     // 记录下这次调用的时间
     *pre  = curr;
@@ -112,6 +112,9 @@ sys_thread_t sys_thread_create(sys_thread_func_t entry, void* arg) {
         return SYS_THREAD_INVALID;
     }
 
+    // 协议栈线程优先于用户进程运行，收到数据包后能及时处理
+    task_set_priority(&task->task, TASK_PRIO_KERNEL);
+
     // 注意启动任务
     task_start(&task->task);
     return &task->task;
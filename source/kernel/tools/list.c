@@ -41,6 +41,31 @@ void list_insert_last(list_t *list, list_node_t *node)
     list->count++;
 }
 
+/**
+ * 将结点插入到指定结点之前，before为0时插入到表尾
+ */
+void list_insert_before(list_t *list, list_node_t *before, list_node_t *node)
+{
+    if (before == (list_node_t *)0)
+    {
+        list_insert_last(list, node);
+        return;
+    }
+
+    if (before == list->first)
+    {
+        list_insert_first(list, node);
+        return;
+    }
+
+    node->pre = before->pre;
+    node->next = before;
+    before->pre->next = node;
+    before->pre = node;
+
+    list->count++;
+}
+
 /**
  * 移除指定链表的头部
  * @param list 操作的链表
@@ -39,10 +39,15 @@ static void detect_memory()
         if (bytes > 20 && (entry->ACPI & 0x0001) == 0)
             continue;
 
-        if (entry->Type == 1)
+        // 4GB以上的内存无法使用，跨过4GB的区域截断到4GB为止
+        if ((entry->Type == 1) && (entry->BaseH == 0))
         {
+            uint32_t size = entry->LengthL;
+            if (entry->LengthH || (entry->BaseL + size < entry->BaseL))
+                size = 0 - entry->BaseL;
+
             boot_info.ram_region_cfg[boot_info.ram_region_count].start = entry->BaseL;
-            boot_info.ram_region_cfg[boot_info.ram_region_count].size = entry->LengthL;
+            boot_info.ram_region_cfg[boot_info.ram_region_count].size = size;
             boot_info.ram_region_count++;
         }
 
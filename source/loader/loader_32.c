@@ -69,7 +69,7 @@ static void die(int code)
 
 /**
  * @brief 开启分页机制
- * 将0-4M空间映射到0-4M和SYS_KERNEL_BASE_ADDR~+4MB空间
+ * 将0-4M空间映射到0-4M和SYS_KERNEL_BASE_ADDR~+4MB空间，低2GB的其余部分一一映射
  * 0-4MB的映射主要用于保护loader自己还能正常工作
  * SYS_KERNEL_BASE_ADDR+4MB则用于为内核提供正确的虚拟地址空间
  */
@@ -87,6 +87,10 @@ void enable_page_mode(void)
         [0] = PDE_P | PDE_PS | PDE_W, // PDE_PS，开启4MB的页
     };
 
+    // 内核建立自己的页表前就要访问全部低端内存(页描述表、页表)，先将低2GB都一一映射
+    for (int i = 1; i < 512; i++)
+        page_dir[i] = ((uint32_t)i << 22) | PDE_P | PDE_PS | PDE_W;
+
     // 设置PSE，以便启用4M的页，而不是4KB
     uint32_t cr4 = read_cr4();
     write_cr4(cr4 | CR4_PSE);
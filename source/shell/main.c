@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "lib_syscall.h"
+#include "lib_sync.h"
 #include "main.h"
 #include <getopt.h>
 #include <stdlib.h>
@@ -232,6 +233,71 @@ static int do_ls(int argc, char **argv)
     return 0;
 }
 
+/**
+ * 经异步提交队列复制：每批先连续读入多块，再一次写出，每批只进入内核两次
+ * 队列或缓冲区分配失败时返回-1，此时还未读写过文件
+ */
+static int cp_batch(int from, int to)
+{
+    char *buf = (char *)malloc(CP_RING_ENTRIES * CP_BLOCK_SIZE);
+    if (buf == (char *)0)
+        return -1;
+
+    ring_t ring;
+    if (ring_init(&ring, CP_RING_ENTRIES) < 0)
+    {
+        free(buf);
+        return -1;
+    }
+
+    int done = 0;
+    while (!done)
+    {
+        for (int i = 0; i < CP_RING_ENTRIES; i++)
+        {
+            ring_sqe_t *sqe = ring_get_sqe(&ring);
+            sqe->opcode = RING_OP_READ;
+            sqe->fd = from;
+            sqe->addr = buf + i * CP_BLOCK_SIZE;
+            sqe->len = CP_BLOCK_SIZE;
+            sqe->user_data = i;
+        }
+        ring_submit_and_wait(&ring, CP_RING_ENTRIES);
+
+        // 完成项按提交顺序排列，读到文件末尾后不再写出后面的块
+        ring_cqe_t *cqe;
+        int writes = 0;
+        while ((cqe = ring_peek_cqe(&ring)) != (ring_cqe_t *)0)
+        {
+            if ((cqe->res > 0) && !done)
+            {
+                ring_sqe_t *sqe = ring_get_sqe(&ring);
+                sqe->opcode = RING_OP_WRITE;
+                sqe->fd = to;
+                sqe->addr = buf + cqe->user_data * CP_BLOCK_SIZE;
+                sqe->len = cqe->res;
+                writes++;
+            }
+            else
+                done = 1;
+
+            ring_cqe_seen(&ring);
+        }
+        ring_submit_and_wait(&ring, writes);
+
+        while ((cqe = ring_peek_cqe(&ring)) != (ring_cqe_t *)0)
+        {
+            if (cqe->res < 0)
+                done = 1;
+            ring_cqe_seen(&ring);
+        }
+    }
+
+    free(buf);
+    ring_free(&ring);
+    return 0;
+}
+
 /**
  * @brief 复制文件
  */
@@ -253,14 +319,27 @@ static int do_cp(int argc, char **argv)
         goto cp_failed;
     }
 
-    char *buf = (char *)malloc(255);
-    int size;
-    while ((size = fread(buf, 1, 255, from)) > 0)
+    // 将源文件映射到内存后直接写出，省去逐块读入缓冲区的复制
+    struct stat st;
+    char *data = (char *)MAP_FAILED;
+    if ((fstat(fileno(from), &st) == 0) && (st.st_size > 0))
+        data = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(from), 0);
+
+    if (data != (char *)MAP_FAILED)
     {
-        fwrite(buf, 1, size, to);
+        fwrite(data, 1, st.st_size, to);
+        munmap(data, st.st_size);
     }
+    else if (cp_batch(fileno(from), fileno(to)) < 0)
+    {
+        // 队列不可用时逐块读写
+        fprintf(stderr, "ring setup failed, copy block by block\n");
 
-    free(buf);
+        char buf[CP_BLOCK_SIZE];
+        int size;
+        while ((size = fread(buf, 1, CP_BLOCK_SIZE, from)) > 0)
+            fwrite(buf, 1, size, to);
+    }
 
 cp_failed:
     if (from)
@@ -289,6 +368,214 @@ static int do_rm(int argc, char **argv)
     return 0;
 }
 
+/**
+ * @brief 显示物理内存的使用情况，单位为KB
+ */
+static int do_free(int argc, char **argv)
+{
+    mem_stat_t stat;
+    if (meminfo(&stat) < 0)
+    {
+        fprintf(stderr, "get memory info failed\n");
+        return -1;
+    }
+
+    int kb = PAGE_SIZE_KB;
+    printf("%-8s %10s %10s %10s\n", "", "total", "used", "free");
+    printf("%-8s %10d %10d %10d\n", "Mem:", stat.total * kb,
+           (stat.total - stat.free) * kb, stat.free * kb);
+    printf("%-8s %10d %10d %10d\n", "High:", stat.high_total * kb,
+           (stat.high_total - stat.high_free) * kb, stat.high_free * kb);
+    printf("page table: %d KB, slab: %d KB, zero pool: %d KB\n",
+           stat.page_table * kb, stat.slab * kb, stat.zero_pool * kb);
+    printf("page fault: %d, fork shared: %d, cow copied: %d\n",
+           stat.page_fault, stat.fork_share, stat.cow_copy);
+    return 0;
+}
+
+/**
+ * @brief 列出进程及其占用的内存
+ */
+static int do_ps(int argc, char **argv)
+{
+    task_stat_t *stat = (task_stat_t *)malloc(PS_TASK_MAX * sizeof(task_stat_t));
+    if (stat == NULL)
+        return -1;
+
+    int count = taskinfo(stat, PS_TASK_MAX);
+    if (count < 0)
+    {
+        fprintf(stderr, "get task info failed\n");
+        free(stat);
+        return -1;
+    }
+
+    printf("%10s %10s %2s %3s %3s %8s %8s %8s %s\n", "PID", "PPID", "S", "NI", "CPU", "RSS(KB)", "FAULT", "COW", "NAME");
+    for (int i = 0; i < count; i++)
+    {
+        task_stat_t *curr = stat + i;
+        printf("%10d %10d %2c %3d %3d %8d %8d %8d %s\n", curr->pid, curr->ppid, curr->state, curr->nice, curr->cpu,
+               curr->rss * PAGE_SIZE_KB, curr->page_fault, curr->cow_copy, curr->name);
+    }
+
+    free(stat);
+    return 0;
+}
+
+static inline uint32_t read_cycles(void)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc"
+                         : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+/**
+ * sysbench命令，比较调用门与sysenter两种方式下getpid的往返周期数
+ */
+static int do_sysbench(int argc, char **argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : SYSBENCH_COUNT;
+    if (count <= 0)
+    {
+        fprintf(stderr, "invalid count: %s\n", argv[1]);
+        return -1;
+    }
+
+    syscall_args_t args;
+    args.id = SYS_getpid;
+
+    uint32_t start = read_cycles();
+    for (int i = 0; i < count; i++)
+        sys_call_gate(&args);
+    uint32_t cycles = read_cycles() - start;
+    printf("call gate: %d cycles/call\n", cycles / count);
+
+    if (!sys_call_has_sysenter())
+    {
+        printf("sysenter: not supported\n");
+        return 0;
+    }
+
+    start = read_cycles();
+    for (int i = 0; i < count; i++)
+        sys_call_sysenter(&args);
+    cycles = read_cycles() - start;
+    printf("sysenter:  %d cycles/call\n", cycles / count);
+    return 0;
+}
+
+/**
+ * mutextest在共享内存中的数据
+ */
+typedef struct _mutextest_t
+{
+    umutex_t mutex;
+    volatile uint32_t counter;
+} mutextest_t;
+
+/**
+ * 加锁后读出计数，不时让出CPU后再写回，锁不起作用时两个进程的累加会互相覆盖
+ */
+static void mutextest_add(mutextest_t *test, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        umutex_lock(&test->mutex);
+        uint32_t value = test->counter;
+        if ((i % MUTEXTEST_YIELD) == 0)
+            yield();
+        test->counter = value + 1;
+        umutex_unlock(&test->mutex);
+    }
+}
+
+/**
+ * mutextest命令，父子进程经共享内存用umutex保护同一计数
+ * 先检查有竞争时加锁的进程在futex上睡眠、解锁时被唤醒，再检查两个进程累加的结果
+ */
+static int do_mutextest(int argc, char **argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : MUTEXTEST_COUNT;
+    if (count <= 0)
+    {
+        fprintf(stderr, "invalid count: %s\n", argv[1]);
+        return -1;
+    }
+
+    int id = shmget(IPC_PRIVATE, sizeof(mutextest_t), IPC_CREAT);
+    if (id < 0)
+    {
+        fprintf(stderr, "shmget failed\n");
+        return -1;
+    }
+
+    // 映射后即可删除，段在最后一个进程解除映射时释放
+    mutextest_t *test = (mutextest_t *)shmat(id, (void *)0, 0);
+    shmctl(id, IPC_RMID);
+    if (test == (mutextest_t *)-1)
+    {
+        fprintf(stderr, "shmat failed\n");
+        return -1;
+    }
+
+    umutex_init(&test->mutex);
+    test->counter = 0;
+
+    // 先持有锁再创建子进程，子进程加锁时必然走有竞争的路径
+    umutex_lock(&test->mutex);
+    fflush(stdout);
+    int pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "fork failed\n");
+        umutex_unlock(&test->mutex);
+        shmdt(test);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        umutex_lock(&test->mutex);
+        test->counter++;
+        umutex_unlock(&test->mutex);
+
+        mutextest_add(test, count);
+        _exit(0);
+    }
+
+    // 子进程睡眠在锁上时，唤醒一次正好唤醒它，它发现锁仍被持有会再次睡眠
+    int woken = 0;
+    for (int ms = 0; (ms < MUTEXTEST_WAIT_MS) && (woken == 0); ms += 10)
+    {
+        msleep(10);
+        woken = futex_wake(&test->mutex.state, 1);
+    }
+
+    // 持锁期间子进程不能进入临界区；解锁后应唤醒子进程，由它先加1
+    int excluded = (test->counter == 0);
+    umutex_unlock(&test->mutex);
+    for (int ms = 0; (ms < MUTEXTEST_WAIT_MS) && (test->counter == 0); ms += 10)
+        msleep(10);
+    int handed = (test->counter != 0);
+
+    mutextest_add(test, count);
+
+    int status;
+    wait(&status);
+
+    uint32_t expected = 2 * count + 1;
+    printf("contended lock sleeps: %s\n", (woken == 1) ? "yes" : "no");
+    printf("excluded while held:   %s\n", excluded ? "yes" : "no");
+    printf("unlock wakes waiter:   %s\n", handed ? "yes" : "no");
+    printf("counter: %d, expected: %d\n", test->counter, expected);
+
+    int ok = (woken == 1) && excluded && handed && (test->counter == expected);
+    shmdt(test);
+    return ok ? 0 : -1;
+}
+
 // 命令列表
 static const cli_cmd_t cmd_list[] = {
     {
@@ -326,6 +613,26 @@ static const cli_cmd_t cmd_list[] = {
         .usage = "rm file - remove file",
         .do_func = do_rm,
     },
+    {
+        .name = "free",
+        .usage = "free -- show memory usage",
+        .do_func = do_free,
+    },
+    {
+        .name = "ps",
+        .usage = "ps -- list tasks and their memory",
+        .do_func = do_ps,
+    },
+    {
+        .name = "sysbench",
+        .usage = "sysbench [count] -- compare syscall entry cost",
+        .do_func = do_sysbench,
+    },
+    {
+        .name = "mutextest",
+        .usage = "mutextest [count] -- check umutex between two processes",
+        .do_func = do_mutextest,
+    },
     {
         .name = "quit",
         .usage = "quit from shell",
@@ -397,18 +704,11 @@ static const char *find_exec_path(const char *filename)
  */
 static void run_exec_file(const char *path, int argc, char **argv)
 {
-    int pid = fork();
+    // 直接由程序文件创建子进程，不必先复制shell的地址空间
+    int pid = spawn(path, argv, (char *const *)0, (const spawn_action_t *)0);
     if (pid < 0)
     {
-        fprintf(stderr, "fork failed: %s", path);
-    }
-    else if (pid == 0)
-    {
-        int err = execve(path, argv, (char *const *)0);
-        if (err < 0)
-            fprintf(stderr, "exec failed: %s", path);
-
-        exit(-1);
+        fprintf(stderr, "exec failed: %s", path);
     }
     else
     {
@@ -5,6 +5,15 @@
 
 #define CLI_MAX_ARG_COUNT 10
 
+#define PS_TASK_MAX 64 // ps最多显示的进程数
+#define PAGE_SIZE_KB 4  // 内核按页统计内存
+#define SYSBENCH_COUNT 100000 // sysbench默认的调用次数
+#define CP_RING_ENTRIES 8   // cp每批提交的读写块数
+#define CP_BLOCK_SIZE 512
+#define MUTEXTEST_COUNT 1000   // mutextest每个进程默认的加锁次数
+#define MUTEXTEST_YIELD 16     // 每隔多少次在持锁时让出CPU，制造竞争
+#define MUTEXTEST_WAIT_MS 1000 // 等待子进程睡眠或被唤醒的最长时间
+
 #define ESC_CMD2(Pn, cmd) "\x1b[" #Pn #cmd
 
 #define ESC_CLEAR_SCREEN ESC_CMD2(2, J)